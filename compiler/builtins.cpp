@@ -0,0 +1,445 @@
+/* This file is part of the Practical programming langauge. https://github.com/Practical/practical-sa
+ *
+ * This file is file is copyright (C) 2018-2020 by its authors.
+ * You can see the file's authors in the AUTHORS file in the project's home repository.
+ *
+ * This is available under the Boost license. The license's text is available under the LICENSE file in the project's
+ * home directory.
+ */
+#include "builtins.h"
+
+#include "support.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include <llvm-c/Target.h>
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace {
+
+struct BuiltinCall {
+    LLVMBuilderRef builder;
+    LLVMModuleRef module;
+    const char *name;
+    const std::vector<LLVMValueRef> &arguments;
+    const std::vector<bool> &signedValues;
+    const char *fileName;
+
+    [[noreturn]] void error( const char *problem ) const {
+        std::string msg = std::string("Builtin ") + name + " " + problem;
+        emitMsg(MsgLevel::Error, fileName, msg.c_str());
+        exit(1);
+    }
+
+    LLVMValueRef integer( unsigned index ) const {
+        LLVMValueRef value = arguments[index];
+        if( LLVMGetTypeKind( LLVMTypeOf(value) )!=LLVMIntegerTypeKind )
+            error( "expects integer arguments" );
+
+        return value;
+    }
+
+    LLVMValueRef pointer( unsigned index ) const {
+        LLVMValueRef value = arguments[index];
+        if( LLVMGetTypeKind( LLVMTypeOf(value) )!=LLVMPointerTypeKind )
+            error( "expects a pointer argument" );
+
+        return value;
+    }
+
+    // Arguments that must be known at compile time, such as prefetch's locality
+    unsigned long long constant( unsigned index ) const {
+        LLVMValueRef value = integer(index);
+        if( !LLVMIsAConstantInt(value) )
+            error( "expects a constant argument" );
+
+        return LLVMConstIntGetZExtValue(value);
+    }
+
+    // Memory orderings are given as constants numbered like C11's memory_order
+    LLVMAtomicOrdering ordering( unsigned index ) const {
+        switch( constant(index) ) {
+        case 0:
+            return LLVMAtomicOrderingMonotonic;
+        case 1: // consume
+        case 2:
+            return LLVMAtomicOrderingAcquire;
+        case 3:
+            return LLVMAtomicOrderingRelease;
+        case 4:
+            return LLVMAtomicOrderingAcquireRelease;
+        case 5:
+            return LLVMAtomicOrderingSequentiallyConsistent;
+        default:
+            error( "expects a memory ordering between 0 (relaxed) and 5 (sequentially consistent)" );
+        }
+    }
+
+    // The pointer argument of an atomic operation. Atomic operations work on integers and pointers of a power of two
+    // size
+    LLVMValueRef atomicPointer( unsigned index ) const {
+        LLVMValueRef address = pointer(index);
+        LLVMTypeRef type = LLVMGetElementType( LLVMTypeOf(address) );
+
+        bool valid = false;
+        switch( LLVMGetTypeKind(type) ) {
+        case LLVMIntegerTypeKind:
+            {
+                unsigned width = LLVMGetIntTypeWidth(type);
+                valid = width>=8 && (width & (width-1))==0;
+            }
+            break;
+        case LLVMPointerTypeKind:
+            valid = true;
+            break;
+        default:
+            break;
+        }
+
+        if( !valid )
+            error( "expects a pointer to an integer or pointer of a power of two size" );
+
+        return address;
+    }
+
+    // The value operand of an atomic operation, converted to the type address points to
+    LLVMValueRef atomicValue( unsigned index, LLVMValueRef address ) const {
+        LLVMTypeRef type = LLVMGetElementType( LLVMTypeOf(address) );
+        LLVMValueRef value = arguments[index];
+        if( LLVMGetTypeKind(type)==LLVMPointerTypeKind ) {
+            if( LLVMTypeOf(value)!=type )
+                error( "expects a value of the type the address points to" );
+
+            return value;
+        }
+
+        return integer( index, type );
+    }
+
+    // An integer argument, converted to type
+    LLVMValueRef integer( unsigned index, LLVMTypeRef type ) const {
+        return convert( integer(index), type, signedValues[index+1] );
+    }
+
+    LLVMValueRef convert( LLVMValueRef value, LLVMTypeRef type, bool isSigned ) const {
+        if( LLVMTypeOf(value)==type )
+            return value;
+
+        return LLVMBuildIntCast2( builder, value, type, isSigned, "" );
+    }
+
+    LLVMValueRef intrinsic(
+            const char *intrinsicName, const std::vector<LLVMTypeRef> &overloads,
+            std::vector<LLVMValueRef> intrinsicArguments ) const
+    {
+        unsigned id = LLVMLookupIntrinsicID( intrinsicName, strlen(intrinsicName) );
+        assert( id!=0 );
+
+        LLVMValueRef function = LLVMGetIntrinsicDeclaration(
+                module, id, const_cast<LLVMTypeRef *>( overloads.data() ), overloads.size() );
+        return LLVMBuildCall2(
+                builder, LLVMGlobalGetValueType(function), function, intrinsicArguments.data(),
+                intrinsicArguments.size(), "" );
+    }
+};
+
+struct Builtin {
+    unsigned numArguments;
+    LLVMValueRef (*build)( const BuiltinCall &call );
+};
+
+LLVMValueRef unaryIntrinsic( const BuiltinCall &call, const char *intrinsicName ) {
+    LLVMValueRef value = call.integer(0);
+    return call.intrinsic( intrinsicName, { LLVMTypeOf(value) }, { value } );
+}
+
+// Count leading or trailing zeros. Defined for zero, where the result is the width of the type
+LLVMValueRef countZeros( const BuiltinCall &call, const char *intrinsicName ) {
+    LLVMValueRef value = call.integer(0);
+    return call.intrinsic(
+            intrinsicName, { LLVMTypeOf(value) }, { value, LLVMConstInt( LLVMInt1Type(), 0, false ) } );
+}
+
+LLVMValueRef funnelShift( const BuiltinCall &call, const char *intrinsicName, LLVMValueRef high, LLVMValueRef low,
+        unsigned shiftIndex )
+{
+    LLVMTypeRef type = LLVMTypeOf(high);
+    if( LLVMTypeOf(low)!=type )
+        call.error( "expects both values to be of the same type" );
+
+    return call.intrinsic( intrinsicName, { type }, { high, low, call.integer( shiftIndex, type ) } );
+}
+
+LLVMValueRef setNonTemporal( LLVMValueRef instruction ) {
+    static const unsigned nonTemporalKind = LLVMGetMDKindID( "nontemporal", strlen("nontemporal") );
+
+    LLVMContextRef ctx = LLVMGetGlobalContext();
+    LLVMMetadataRef one = LLVMValueAsMetadata( LLVMConstInt( LLVMInt32Type(), 1, false ) );
+    LLVMSetMetadata( instruction, nonTemporalKind, LLVMMetadataAsValue( ctx, LLVMMDNodeInContext2( ctx, &one, 1 ) ) );
+
+    return instruction;
+}
+
+// Atomic loads and stores must be aligned to their size
+void setAtomicAlignment( const BuiltinCall &call, LLVMValueRef instruction, LLVMTypeRef type ) {
+    unsigned size = LLVMGetTypeKind(type)==LLVMPointerTypeKind ?
+            LLVMPointerSize( LLVMGetModuleDataLayout(call.module) ) :
+            LLVMGetIntTypeWidth(type) / 8;
+    LLVMSetAlignment( instruction, size );
+}
+
+// fetch_op(address, value, ordering): atomically apply the operation to the value at address, returning the old value
+LLVMValueRef atomicReadModifyWrite( const BuiltinCall &call, LLVMAtomicRMWBinOp operation ) {
+    LLVMValueRef address = call.atomicPointer(0);
+    if( LLVMGetTypeKind( LLVMGetElementType( LLVMTypeOf(address) ) )!=LLVMIntegerTypeKind )
+        call.error( "expects a pointer to an integer" );
+
+    return LLVMBuildAtomicRMW(
+            call.builder, operation, address, call.atomicValue( 1, address ), call.ordering(2), false );
+}
+
+// compare_exchange(address, expected address, desired, success ordering, failure ordering): if the value at address
+// equals the value at expected address, replace it with desired. Otherwise store the value found into expected
+// address. Returns whether the exchange happened. Weak exchanges may fail spuriously, which is cheaper on some CPUs
+// when called in a loop anyway.
+LLVMValueRef compareExchange( const BuiltinCall &call, bool weak ) {
+    LLVMValueRef address = call.atomicPointer(0);
+    LLVMValueRef expectedAddress = call.pointer(1);
+    if( LLVMTypeOf(expectedAddress)!=LLVMTypeOf(address) )
+        call.error( "expects the expected value's address to be of the same type as the address" );
+
+    LLVMAtomicOrdering success = call.ordering(3), failure = call.ordering(4);
+    if( failure==LLVMAtomicOrderingRelease || failure==LLVMAtomicOrderingAcquireRelease )
+        call.error( "expects a failure ordering without release semantics" );
+
+    LLVMTypeRef type = LLVMGetElementType( LLVMTypeOf(address) );
+    LLVMValueRef expected = LLVMBuildLoad2( call.builder, type, expectedAddress, "" );
+    LLVMValueRef exchange = LLVMBuildAtomicCmpXchg(
+            call.builder, address, expected, call.atomicValue( 2, address ), success, failure, false );
+    LLVMSetWeak( exchange, weak );
+
+    LLVMValueRef exchanged = LLVMBuildExtractValue( call.builder, exchange, 1, "" );
+    LLVMValueRef found = LLVMBuildExtractValue( call.builder, exchange, 0, "" );
+    // Storing back the value found is harmless when the exchange succeeded, as it is then the expected value
+    LLVMBuildStore( call.builder, found, expectedAddress );
+
+    return exchanged;
+}
+
+// Coroutine handles are the pointers calling a coroutine returns
+LLVMValueRef coroutineHandle( const BuiltinCall &call ) {
+    return LLVMBuildPointerCast( call.builder, call.pointer(0), LLVMPointerType( LLVMInt8Type(), 0 ), "" );
+}
+
+const std::unordered_map< std::string_view, Builtin > builtins{
+    { "__builtin_popcount", { 1, []( const BuiltinCall &call ) {
+            return unaryIntrinsic( call, "llvm.ctpop" );
+        } } },
+    { "__builtin_clz", { 1, []( const BuiltinCall &call ) {
+            return countZeros( call, "llvm.ctlz" );
+        } } },
+    { "__builtin_ctz", { 1, []( const BuiltinCall &call ) {
+            return countZeros( call, "llvm.cttz" );
+        } } },
+    { "__builtin_bswap", { 1, []( const BuiltinCall &call ) {
+            if( LLVMGetIntTypeWidth( LLVMTypeOf( call.integer(0) ) ) % 16 != 0 )
+                call.error( "expects an argument a whole number of byte pairs wide" );
+
+            return unaryIntrinsic( call, "llvm.bswap" );
+        } } },
+    // Rotates are funnel shifts of a value with itself
+    { "__builtin_rotl", { 2, []( const BuiltinCall &call ) {
+            LLVMValueRef value = call.integer(0);
+            return funnelShift( call, "llvm.fshl", value, value, 1 );
+        } } },
+    { "__builtin_rotr", { 2, []( const BuiltinCall &call ) {
+            LLVMValueRef value = call.integer(0);
+            return funnelShift( call, "llvm.fshr", value, value, 1 );
+        } } },
+    { "__builtin_fshl", { 3, []( const BuiltinCall &call ) {
+            return funnelShift( call, "llvm.fshl", call.integer(0), call.integer(1), 2 );
+        } } },
+    { "__builtin_fshr", { 3, []( const BuiltinCall &call ) {
+            return funnelShift( call, "llvm.fshr", call.integer(0), call.integer(1), 2 );
+        } } },
+    // prefetch(address, write, locality): write is 0 or 1, locality 0 (none) to 3 (keep in all cache levels)
+    { "__builtin_prefetch", { 3, []( const BuiltinCall &call ) {
+            unsigned long long write = call.constant(1), locality = call.constant(2);
+            if( write>1 || locality>3 )
+                call.error( "expects write to be 0 or 1 and locality to be between 0 and 3" );
+
+            LLVMTypeRef bytePointer = LLVMPointerType( LLVMInt8Type(), 0 );
+            LLVMTypeRef i32 = LLVMInt32Type();
+            return call.intrinsic( "llvm.prefetch", { bytePointer }, {
+                    LLVMBuildBitCast( call.builder, call.pointer(0), bytePointer, "" ),
+                    LLVMConstInt( i32, write, false ),
+                    LLVMConstInt( i32, locality, false ),
+                    LLVMConstInt( i32, 1, false ) } ); // Data cache
+        } } },
+    // Memory accesses that are not expected to be reused soon, and should not displace other data from the cache
+    { "__builtin_nontemporal_load", { 1, []( const BuiltinCall &call ) {
+            LLVMValueRef address = call.pointer(0);
+            return setNonTemporal(
+                    LLVMBuildLoad2( call.builder, LLVMGetElementType( LLVMTypeOf(address) ), address, "" ) );
+        } } },
+    { "__builtin_nontemporal_store", { 2, []( const BuiltinCall &call ) {
+            LLVMValueRef address = call.pointer(0);
+            LLVMValueRef value = call.integer( 1, LLVMGetElementType( LLVMTypeOf(address) ) );
+            return setNonTemporal( LLVMBuildStore( call.builder, value, address ) );
+        } } },
+    // memcpy(destination, source, size, alignment) and memset(destination, byte, size, alignment). The alignment
+    // applies to both pointers, and must be a constant power of two
+    { "__builtin_memcpy", { 4, []( const BuiltinCall &call ) {
+            unsigned long long alignment = call.constant(3);
+            if( alignment==0 || (alignment & (alignment-1))!=0 )
+                call.error( "expects the alignment to be a power of two" );
+
+            return LLVMBuildMemCpy(
+                    call.builder, call.pointer(0), alignment, call.pointer(1), alignment, call.integer(2) );
+        } } },
+    { "__builtin_memset", { 4, []( const BuiltinCall &call ) {
+            unsigned long long alignment = call.constant(3);
+            if( alignment==0 || (alignment & (alignment-1))!=0 )
+                call.error( "expects the alignment to be a power of two" );
+
+            return LLVMBuildMemSet(
+                    call.builder, call.pointer(0), call.integer( 1, LLVMInt8Type() ), call.integer(2),
+                    alignment );
+        } } },
+    { "__builtin_assume", { 1, []( const BuiltinCall &call ) {
+            LLVMValueRef condition = call.integer(0);
+            if( LLVMTypeOf(condition)!=LLVMInt1Type() )
+                condition = LLVMBuildICmp(
+                        call.builder, LLVMIntNE, condition, LLVMConstNull( LLVMTypeOf(condition) ), "" );
+
+            return call.intrinsic( "llvm.assume", {}, { condition } );
+        } } },
+    // Atomic operations. Memory orderings are constants: 0 relaxed, 1 consume (treated as acquire), 2 acquire,
+    // 3 release, 4 acquire-release and 5 sequentially consistent
+    { "__builtin_atomic_load", { 2, []( const BuiltinCall &call ) {
+            LLVMValueRef address = call.atomicPointer(0);
+            LLVMAtomicOrdering ordering = call.ordering(1);
+            if( ordering==LLVMAtomicOrderingRelease || ordering==LLVMAtomicOrderingAcquireRelease )
+                call.error( "expects an ordering without release semantics" );
+
+            LLVMTypeRef type = LLVMGetElementType( LLVMTypeOf(address) );
+            LLVMValueRef load = LLVMBuildLoad2( call.builder, type, address, "" );
+            LLVMSetOrdering( load, ordering );
+            setAtomicAlignment( call, load, type );
+
+            return load;
+        } } },
+    { "__builtin_atomic_store", { 3, []( const BuiltinCall &call ) {
+            LLVMValueRef address = call.atomicPointer(0);
+            LLVMAtomicOrdering ordering = call.ordering(2);
+            if( ordering==LLVMAtomicOrderingAcquire || ordering==LLVMAtomicOrderingAcquireRelease )
+                call.error( "expects an ordering without acquire semantics" );
+
+            LLVMValueRef store = LLVMBuildStore( call.builder, call.atomicValue( 1, address ), address );
+            LLVMSetOrdering( store, ordering );
+            setAtomicAlignment( call, store, LLVMGetElementType( LLVMTypeOf(address) ) );
+
+            return store;
+        } } },
+    { "__builtin_atomic_exchange", { 3, []( const BuiltinCall &call ) {
+            return atomicReadModifyWrite( call, LLVMAtomicRMWBinOpXchg );
+        } } },
+    { "__builtin_atomic_fetch_add", { 3, []( const BuiltinCall &call ) {
+            return atomicReadModifyWrite( call, LLVMAtomicRMWBinOpAdd );
+        } } },
+    { "__builtin_atomic_fetch_sub", { 3, []( const BuiltinCall &call ) {
+            return atomicReadModifyWrite( call, LLVMAtomicRMWBinOpSub );
+        } } },
+    { "__builtin_atomic_fetch_and", { 3, []( const BuiltinCall &call ) {
+            return atomicReadModifyWrite( call, LLVMAtomicRMWBinOpAnd );
+        } } },
+    { "__builtin_atomic_fetch_or", { 3, []( const BuiltinCall &call ) {
+            return atomicReadModifyWrite( call, LLVMAtomicRMWBinOpOr );
+        } } },
+    { "__builtin_atomic_fetch_xor", { 3, []( const BuiltinCall &call ) {
+            return atomicReadModifyWrite( call, LLVMAtomicRMWBinOpXor );
+        } } },
+    { "__builtin_atomic_fetch_max_signed", { 3, []( const BuiltinCall &call ) {
+            return atomicReadModifyWrite( call, LLVMAtomicRMWBinOpMax );
+        } } },
+    { "__builtin_atomic_fetch_min_signed", { 3, []( const BuiltinCall &call ) {
+            return atomicReadModifyWrite( call, LLVMAtomicRMWBinOpMin );
+        } } },
+    { "__builtin_atomic_fetch_max_unsigned", { 3, []( const BuiltinCall &call ) {
+            return atomicReadModifyWrite( call, LLVMAtomicRMWBinOpUMax );
+        } } },
+    { "__builtin_atomic_fetch_min_unsigned", { 3, []( const BuiltinCall &call ) {
+            return atomicReadModifyWrite( call, LLVMAtomicRMWBinOpUMin );
+        } } },
+    { "__builtin_atomic_compare_exchange_strong", { 5, []( const BuiltinCall &call ) {
+            return compareExchange( call, false );
+        } } },
+    { "__builtin_atomic_compare_exchange_weak", { 5, []( const BuiltinCall &call ) {
+            return compareExchange( call, true );
+        } } },
+    { "__builtin_atomic_fence", { 1, []( const BuiltinCall &call ) {
+            LLVMAtomicOrdering ordering = call.ordering(0);
+            if( ordering==LLVMAtomicOrderingMonotonic )
+                call.error( "expects an ordering stronger than relaxed" );
+
+            return LLVMBuildFence( call.builder, ordering, false, "" );
+        } } },
+    // Resuming or destroying a coroutine costs an indirect call, or a direct one where the handle's origin is known
+    { "__builtin_coro_resume", { 1, []( const BuiltinCall &call ) {
+            return call.intrinsic( "llvm.coro.resume", {}, { coroutineHandle(call) } );
+        } } },
+    { "__builtin_coro_destroy", { 1, []( const BuiltinCall &call ) {
+            return call.intrinsic( "llvm.coro.destroy", {}, { coroutineHandle(call) } );
+        } } },
+    // Whether the coroutine finished (returned). A finished coroutine may only be destroyed
+    { "__builtin_coro_done", { 1, []( const BuiltinCall &call ) {
+            return call.intrinsic( "llvm.coro.done", {}, { coroutineHandle(call) } );
+        } } },
+    // expect(value, expected): value, with a hint that it is usually expected
+    { "__builtin_expect", { 2, []( const BuiltinCall &call ) {
+            LLVMValueRef value = call.integer(0);
+            LLVMTypeRef type = LLVMTypeOf(value);
+            return call.intrinsic( "llvm.expect", { type }, { value, call.integer( 1, type ) } );
+        } } },
+};
+
+} // Anonymous namespace
+
+bool isBuiltin( const char *name ) {
+    return builtins.count( name )!=0;
+}
+
+LLVMValueRef buildBuiltinCall(
+        LLVMBuilderRef builder, LLVMModuleRef module, const char *name, const std::vector<LLVMValueRef> &arguments,
+        const std::vector<bool> &signedValues, LLVMTypeRef returnType, const char *fileName )
+{
+    auto builtin = builtins.find( name );
+    if( builtin==builtins.end() )
+        return nullptr;
+
+    BuiltinCall call{ builder, module, name, arguments, signedValues, fileName };
+    if( arguments.size()!=builtin->second.numArguments ) {
+        std::string problem = "expects " + std::to_string( builtin->second.numArguments ) + " arguments";
+        call.error( problem.c_str() );
+    }
+
+    LLVMValueRef result = builtin->second.build( call );
+
+    if( LLVMGetTypeKind(returnType)==LLVMVoidTypeKind || LLVMGetTypeKind( LLVMTypeOf(result) )==LLVMVoidTypeKind )
+        return result;
+
+    if( LLVMGetTypeKind(returnType)!=LLVMIntegerTypeKind || LLVMGetTypeKind( LLVMTypeOf(result) )!=LLVMIntegerTypeKind )
+    {
+        if( LLVMTypeOf(result)!=returnType )
+            call.error( "is declared with the wrong return type" );
+
+        return result;
+    }
+
+    // The builtin's result is of the signedness it is declared to return
+    return call.convert( result, returnType, signedValues[0] );
+}
@@ -0,0 +1,28 @@
+/* This file is part of the Practical programming langauge. https://github.com/Practical/practical-sa
+ *
+ * To the extent header files enjoy copyright protection, this file is file is copyright (C) 2018-2020 by its authors
+ * You can see the file's authors in the AUTHORS file in the project's home repository.
+ *
+ * This is available under the Boost license. The license's text is available under the LICENSE file in the project's
+ * home directory.
+ */
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+#include <llvm-c/Core.h>
+
+#include <vector>
+
+// Builtin functions are declared like any other function, but calls to them are lowered directly to LLVM intrinsics
+// and instructions.
+//
+bool isBuiltin( const char *name );
+
+// Returns the value of the call, or null if name is not a builtin. The arguments have the types of the builtin's
+// declaration, and the result is converted to its declared return type. signedValues says which of the return value
+// (first) and the arguments are signed integers, which are sign extended where they are widened.
+LLVMValueRef buildBuiltinCall(
+        LLVMBuilderRef builder, LLVMModuleRef module, const char *name, const std::vector<LLVMValueRef> &arguments,
+        const std::vector<bool> &signedValues, LLVMTypeRef returnType, const char *fileName );
+
+#endif // BUILTINS_H
@@ -8,11 +8,27 @@
  */
 #include "code_gen.h"
 
+#include "builtins.h"
+#include "const_eval.h"
+#include "llvm_ext.h"
+#include "lookup_context.h"
+#include "object_output.h"
+#include "support.h"
 #include "utils.h"
 
 #include <llvm-c/Analysis.h>
-
+#include <llvm-c/Transforms/InstCombine.h>
+#include <llvm-c/Transforms/PassBuilder.h>
+#include <llvm-c/Transforms/Scalar.h>
+#include <llvm-c/Transforms/Utils.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
 #include <sstream>
+#include <unordered_set>
 
 JumpPointData::JumpPointData( Type type ) : type(type) {
 }
@@ -48,7 +64,7 @@ static LLVMTypeRef toLLVMType(StaticType::CPtr practiType, TypeUsage type = Type
         TypeUsage type;
 
         LLVMTypeRef operator()( const PracticalSemanticAnalyzer::StaticType::Scalar *scalar ) {
-            return static_cast<LLVMTypeRef>( scalar->getTypeId().p );
+            return scalarType( scalar->getTypeId() ).type;
         }
         LLVMTypeRef operator()( const PracticalSemanticAnalyzer::StaticType::Function *function ) {
             std::vector<LLVMTypeRef> argumentsTypes;
@@ -105,48 +121,187 @@ void FunctionGenImpl::functionEnter(
         String name, StaticType::CPtr returnType, Slice<const ArgumentDeclaration> arguments,
         String file, const SourceLocation &location)
 {
-    auto llvmModule = module->getLLVMModule();
+    std::vector<LoweredArgument> loweredArguments;
+    loweredArguments.reserve( arguments.size() );
+    for( const auto &argument : arguments ) {
+        loweredArguments.emplace_back( LoweredArgument{
+                .name = argument.name,
+                .type = toLLVMType(argument.type, TypeUsage::FunctionParameter),
+                .lvalueId = argument.lvalueId } );
+    }
+
+    functionEnter( name, loweredArguments, file, location );
+}
 
-    llvmFunction = LLVMGetNamedFunction( llvmModule, toStdString(name).c_str() );
+// The function's struct PracticalTimingFunction, as declared in runtime/practical_timing.h
+static LLVMValueRef buildTimingDescriptor( LLVMModuleRef llvmModule, const std::string &functionName ) {
+    LLVMValueRef nameString = LLVMConstString( functionName.c_str(), functionName.size(), false );
+    LLVMValueRef nameGlobal = LLVMAddGlobal( llvmModule, LLVMTypeOf(nameString), "" );
+    LLVMSetInitializer( nameGlobal, nameString );
+    LLVMSetGlobalConstant( nameGlobal, true );
+    LLVMSetLinkage( nameGlobal, LLVMPrivateLinkage );
+    LLVMSetUnnamedAddress( nameGlobal, LLVMGlobalUnnamedAddr );
+
+    LLVMValueRef elements[] = {
+        LLVMConstInt( LLVMInt32Type(), 0, false ),
+        LLVMConstBitCast( nameGlobal, LLVMPointerType( LLVMInt8Type(), 0 ) )
+    };
+    LLVMValueRef initializer = LLVMConstStruct( elements, 2, false );
+
+    // The runtime writes the function's id into it, so not constant
+    LLVMValueRef descriptor = LLVMAddGlobal(
+            llvmModule, LLVMTypeOf(initializer), ("__practical_timing." + functionName).c_str() );
+    LLVMSetInitializer( descriptor, initializer );
+    LLVMSetLinkage( descriptor, LLVMInternalLinkage );
+
+    return descriptor;
+}
+
+void FunctionGenImpl::functionEnter(
+        String name, const std::vector<LoweredArgument> &arguments, String file, const SourceLocation &location )
+{
+    llvmModule = module->functionModule( name );
+    llvmFunction = module->lookupFunction( llvmModule, toStdString(name).c_str() );
 
     builder = LLVMCreateBuilder();
-    addBlock();
+
+    // The function's location is the only one the front end provides, so every instruction gets it
+    LLVMMetadataRef scope = module->functionScope( llvmModule, llvmFunction, file, location );
+    if( scope!=nullptr ) {
+        LLVMSetCurrentDebugLocation2( builder, LLVMDIBuilderCreateDebugLocation(
+                    LLVMGetGlobalContext(), location.line, location.col, scope, nullptr ) );
+    }
+
+    // All stack variables are allocated in the entry block, regardless of where they are declared. This lets mem2reg
+    // promote them and keeps loop bodies free of allocas.
+    LLVMBasicBlockRef entryBlock = addBlock("entry");
+    bodyBlock = addBlock();
+    setCurrentBlock( entryBlock );
+    entryBranch = LLVMBuildBr( builder, bodyBlock );
 
     // Allocate stack location for the arguments, so that they behave like lvalues
+    LLVMPositionBuilderBefore( builder, entryBranch );
     for( size_t i = 0; i<arguments.size(); ++i ) {
-        addExpression( arguments[i].lvalueId, LLVMBuildAlloca(builder, toLLVMType(arguments[i].type, TypeUsage::FunctionParameter), toCStr(name)) );
-        LLVMBuildStore(builder, LLVMGetParam( llvmFunction, i ), lookupExpression(arguments[i].lvalueId));
+        LLVMValueRef slot = LLVMBuildAlloca( builder, arguments[i].type, toCStr(arguments[i].name) );
+        addExpression( arguments[i].lvalueId, slot );
+        argumentSlots.push_back( slot );
+        setAccessType( LLVMBuildStore(builder, LLVMGetParam( llvmFunction, i ), slot) );
     }
+
+    functionName = toStdString(name);
+    fileName = toStdString(file);
+    module->noteCall( functionName );
+
+    if( module->getOptions().coroutines.functions.count( functionName )!=0 ) {
+        beginCoroutine();
+    } else if( module->getOptions().timingProbes ) {
+        // Coroutines return on every suspension, and so are not timed
+        timingFunction = buildTimingDescriptor( llvmModule, functionName );
+        LLVMPositionBuilderBefore( builder, entryBranch );
+        buildTimingProbe( "__practical_timing_enter" );
+    }
+
+    setCurrentBlock( bodyBlock );
 }
 
 void FunctionGenImpl::functionLeave()
 {
-    // XXX Need to support "return" statement from middle of function definition
+    assert( branchStack.empty() );
+
+    if( currentBlock==deadBlock && LLVMGetFirstInstruction(deadBlock)==nullptr ) {
+        LLVMDeleteBasicBlock( deadBlock );
+    } else if( LLVMGetBasicBlockTerminator(currentBlock)==nullptr ) {
+        // Flow never falls off the end of a function
+        LLVMBuildUnreachable( builder );
+    }
+
+    if( coroutine.id!=nullptr )
+        finishCoroutine();
+
+    eraseDeadAggregateLoads();
+    coalesceStores();
+    lowerTailCalls();
+    finalizeLoops();
+
     LLVMDisposeBuilder(builder);
     builder = nullptr;
     currentBlock = nullptr;
+    deadBlock = nullptr;
+    entryBranch = nullptr;
+    bodyBlock = nullptr;
+    tailRecursionLatch = nullptr;
+    aggregateLoads.clear();
+    valueNumbers.clear();
+    timingFunction = nullptr;
+
+    // May dispose of the function's module when streaming
+    module->functionDone( llvmFunction );
     llvmFunction = nullptr;
+    llvmModule = nullptr;
+}
+
+// Calls that may be turned into tail calls of function. The call must return what the function does, so a call
+// returning a value is no candidate before a "ret void". Intrinsics are not real calls
+static bool isTailCallCandidate( LLVMValueRef instruction, LLVMValueRef function ) {
+    if( !LLVMIsACallInst(instruction) ||
+            LLVMTypeOf(instruction)!=LLVMGetReturnType( LLVMGlobalGetValueType(function) ) )
+    {
+        return false;
+    }
+
+    LLVMValueRef callee = LLVMGetCalledValue(instruction);
+    return !LLVMIsAFunction(callee) || LLVMGetIntrinsicID(callee)==0;
 }
 
 void FunctionGenImpl::returnValue(ExpressionId id) {
-    LLVMBuildRet( builder, lookupExpression(id) );
+    if( coroutine.id!=nullptr ) {
+        // The caller already has the coroutine's handle. Returning finishes the coroutine
+        LLVMBuildBr( builder, coroutine.finalBlock );
+        startDeadBlock();
+        return;
+    }
+
+    LLVMValueRef value = lookupExpression(id);
+    LLVMValueRef lastInstruction = LLVMGetLastInstruction(currentBlock);
+    if( timingFunction!=nullptr )
+        buildTimingProbe( "__practical_timing_exit" );
+    LLVMValueRef ret = LLVMBuildRet( builder, value );
+    if( timingFunction==nullptr && value==lastInstruction && isTailCallCandidate( value, llvmFunction ) )
+        noteTailCall( ret );
+
+    startDeadBlock();
 }
 
 void FunctionGenImpl::returnValue() {
-    LLVMBuildRetVoid( builder );
+    LLVMValueRef lastInstruction = LLVMGetLastInstruction(currentBlock);
+    if( timingFunction!=nullptr )
+        buildTimingProbe( "__practical_timing_exit" );
+    LLVMValueRef ret = LLVMBuildRetVoid( builder );
+    if( timingFunction==nullptr && lastInstruction!=nullptr && isTailCallCandidate( lastInstruction, llvmFunction ) )
+        noteTailCall( ret );
+
+    startDeadBlock();
 }
 
 void FunctionGenImpl::conditionalBranch(
         ExpressionId id, StaticType::CPtr type, ExpressionId conditionExpression, JumpPointId elsePoint,
         JumpPointId continuationPoint)
+{
+    conditionalBranch(
+            id, id!=ExpressionId() ? toLLVMType(type) : nullptr, conditionExpression, elsePoint, continuationPoint );
+}
+
+void FunctionGenImpl::conditionalBranch(
+        ExpressionId id, LLVMTypeRef type, ExpressionId conditionExpression, JumpPointId elsePoint,
+        JumpPointId continuationPoint)
 {
     LLVMBasicBlockRef previousCurrent = currentBlock;
 
     auto ifBlock = addBlock();
     BranchPointData &branchData = branchStack.emplace_back();
+    branchData.ifBlock = ifBlock;
     branchData.conditionValue = id;
     branchData.type = type;
-    branchData.phiBlocks[0] = currentBlock;
 
     LLVMBasicBlockRef nextBlockInFlow = nullptr;
     if( elsePoint!=JumpPointId() ) {
@@ -157,8 +312,8 @@ void FunctionGenImpl::conditionalBranch(
                 std::forward_as_tuple( JumpPointData::Type::Branch )
         );
         assert( jumpData.second );
-        nextBlockInFlow = branchData.phiBlocks[1] = branchData.elsePointBlock = addBlock( jumpData.first->second.getLabel() );
-        jumpData.first->second.definePoint();
+        nextBlockInFlow = branchData.elsePointBlock = jumpData.first->second.block =
+                addBlock( jumpData.first->second.getLabel() );
     } else
         assert( id==ExpressionId() );
 
@@ -169,14 +324,14 @@ void FunctionGenImpl::conditionalBranch(
             std::forward_as_tuple( JumpPointData::Type::Branch )
     );
     assert( jumpData.second );
-    branchData.continuationPointBlock = addBlock( jumpData.first->second.getLabel() );
-    jumpData.first->second.definePoint();
+    branchData.continuationPointBlock = jumpData.first->second.block = addBlock( jumpData.first->second.getLabel() );
 
     if( !nextBlockInFlow )
         nextBlockInFlow = branchData.continuationPointBlock;
 
     setCurrentBlock( previousCurrent );
-    LLVMBuildCondBr( builder, lookupExpression(conditionExpression), ifBlock, nextBlockInFlow );
+    branchData.branchInstruction =
+            LLVMBuildCondBr( builder, lookupExpression(conditionExpression), ifBlock, nextBlockInFlow );
 
     setCurrentBlock( ifBlock );
 }
@@ -206,8 +361,10 @@ void FunctionGenImpl::setJumpPoint(JumpPointId id, String name) {
         if( stackTop.elsePointId!=JumpPointId() ) {
             if( id==stackTop.elsePointId ) {
                 // We just finished the "if" clause, need to start the "else" clause
-                LLVMBuildBr( builder, stackTop.continuationPointBlock );
+                stackTop.phiBlocks[0] = currentBlock;
+                closeBlock( stackTop.continuationPointBlock );
                 setCurrentBlock( stackTop.elsePointBlock );
+                jumpPointsTable.at( id ).definePoint();
                 stackTop.elsePointId = JumpPointId();
 
                 return;
@@ -215,15 +372,25 @@ void FunctionGenImpl::setJumpPoint(JumpPointId id, String name) {
         } else {
             if( id==stackTop.continuationPointId ) {
                 // We just finished the "else" clause (or an elseless "if" clause")
-                LLVMBuildBr( builder, stackTop.continuationPointBlock );
+                stackTop.phiBlocks[1] = currentBlock;
+
+                if( stackTop.conditionValue!=ExpressionId() && foldToSelect( stackTop ) ) {
+                    jumpPointsTable.at( id ).definePoint();
+                    branchStack.pop_back();
+
+                    return;
+                }
+
+                closeBlock( stackTop.continuationPointBlock );
                 setCurrentBlock( stackTop.continuationPointBlock );
+                jumpPointsTable.at( id ).definePoint();
 
                 if( stackTop.conditionValue!=ExpressionId() ) {
                     // We need to set a value to the condition
                     assert( stackTop.ifBlockValue!=ExpressionId() );
                     assert( stackTop.elseBlockValue!=ExpressionId() );
 
-                    LLVMValueRef phiValue = LLVMBuildPhi(builder, toLLVMType(stackTop.type), "");
+                    LLVMValueRef phiValue = LLVMBuildPhi(builder, stackTop.type, "");
                     addExpression( stackTop.conditionValue, phiValue );
                     LLVMValueRef values[2] = {
                         lookupExpression(stackTop.ifBlockValue),
@@ -239,17 +406,45 @@ void FunctionGenImpl::setJumpPoint(JumpPointId id, String name) {
         }
     }
 
-    abort(); // XXX setJumpPoint not as part of a branch not yet implemented
-    // LLVMBuildBr( builder, dest );
+    // A free standing jump point: a label, a loop header or a loop's exit
+    JumpPointData &point = lookupJumpPoint( id, JumpPointData::Type::Label, toStdString(name) );
+    LLVMBasicBlockRef block = jumpPointBlock( point );
+    LLVMMoveBasicBlockAfter( block, currentBlock );
+    closeBlock( block );
+    setCurrentBlock( block );
+    point.definePoint();
 }
 
 void FunctionGenImpl::jump(JumpPointId destination) {
-    // TODO implement
-    abort();
+    JumpPointData &point = lookupJumpPoint( destination, JumpPointData::Type::Label );
+    LLVMBasicBlockRef target = jumpPointBlock( point );
+
+    if( point.isDefined() ) {
+        // A back edge, which makes the destination a loop header. Route all back edges through one latch block, so
+        // the loop optimizer sees the canonical preheader/header/latch form.
+        if( point.latch==nullptr ) {
+            point.latch = LLVMAppendBasicBlock( llvmFunction, "latch" );
+            LLVMMoveBasicBlockAfter( point.latch, currentBlock );
+            LLVMPositionBuilderAtEnd( builder, point.latch );
+            LLVMBuildBr( builder, target );
+            LLVMPositionBuilderAtEnd( builder, currentBlock );
+
+            loops.emplace_back( LoopData{ .header = target, .latch = point.latch } );
+        }
+
+        target = point.latch;
+    }
+
+    LLVMBuildBr( builder, target );
+    startDeadBlock();
 }
 
 void FunctionGenImpl::setLiteral(ExpressionId id, LongEnoughInt value, StaticType::CPtr type) {
-    addExpression( id, LLVMConstInt(toLLVMType(type), value, true) );
+    setLiteral( id, value, toLLVMType(type) );
+}
+
+void FunctionGenImpl::setLiteral(ExpressionId id, LongEnoughInt value, LLVMTypeRef type) {
+    addExpression( id, LLVMConstInt(type, value, true) );
 }
 
 void FunctionGenImpl::setLiteral(ExpressionId id, bool value) {
@@ -258,7 +453,7 @@ void FunctionGenImpl::setLiteral(ExpressionId id, bool value) {
 
 void FunctionGenImpl::setLiteral(ExpressionId id, String value) {
     LLVMTypeRef strType = LLVMArrayType( LLVMInt8Type(), value.size() );
-    LLVMValueRef str = LLVMAddGlobal(module->getLLVMModule(), strType, "");
+    LLVMValueRef str = LLVMAddGlobal(llvmModule, strType, "");
     LLVMSetInitializer(str, LLVMConstString( value.get(), value.size(), true ));
     LLVMSetGlobalConstant(str, true);
     LLVMSetLinkage(str, LLVMPrivateLinkage);
@@ -273,25 +468,55 @@ void FunctionGenImpl::setLiteral(ExpressionId id, String value) {
 }
 
 void FunctionGenImpl::setLiteralNull(ExpressionId id, StaticType::CPtr type) {
-    addExpression( id, LLVMConstNull( toLLVMType(type) ) );
+    setLiteralNull( id, toLLVMType(type) );
+}
+
+void FunctionGenImpl::setLiteralNull(ExpressionId id, LLVMTypeRef type) {
+    addExpression( id, LLVMConstNull( type ) );
 }
 
 void FunctionGenImpl::allocateStackVar(ExpressionId id, StaticType::CPtr type, String name) {
-    addExpression( id, LLVMBuildAlloca(builder, toLLVMType(type), toCStr(name)) );
+    allocateStackVar( id, toLLVMType(type), name );
+}
+
+void FunctionGenImpl::allocateStackVar(ExpressionId id, LLVMTypeRef type, String name) {
+    addExpression( id, buildAlloca( type, name ) );
+}
+
+static bool isAggregate( LLVMTypeRef type ) {
+    LLVMTypeKind kind = LLVMGetTypeKind(type);
+    return kind==LLVMStructTypeKind || kind==LLVMArrayTypeKind;
 }
 
 void FunctionGenImpl::assign( ExpressionId lvalue, ExpressionId rvalue ) {
-    LLVMBuildStore(builder, lookupExpression(rvalue), lookupExpression(lvalue));
+    LLVMValueRef value = lookupExpression(rvalue);
+    LLVMValueRef address = lookupExpression(lvalue);
+
+    if( isAggregate( LLVMTypeOf(value) ) ) {
+        storeAggregate( address, value );
+    } else {
+        setAccessType( LLVMBuildStore(builder, value, address) );
+    }
 }
 
 void FunctionGenImpl::dereferencePointer( ExpressionId id, StaticType::CPtr type, ExpressionId addr ) {
-    addExpression( id, LLVMBuildLoad(builder, lookupExpression(addr), "") );
+    LLVMValueRef value = LLVMBuildLoad(builder, lookupExpression(addr), "");
+    if( isAggregate( LLVMTypeOf(value) ) )
+        aggregateLoads.push_back( value );
+    else
+        setAccessType( value );
+
+    addExpression( id, value );
 }
 
 void FunctionGenImpl::truncateInteger(
         ExpressionId id, ExpressionId source, StaticType::CPtr sourceType, StaticType::CPtr destType )
 {
-    addExpression( id, LLVMBuildTrunc(builder, lookupExpression(source), toLLVMType(destType), "") );
+    truncateInteger( id, source, toLLVMType(destType) );
+}
+
+void FunctionGenImpl::truncateInteger( ExpressionId id, ExpressionId source, LLVMTypeRef destType ) {
+    addExpression( id, LLVMBuildTrunc(builder, lookupExpression(source), destType, "") );
 }
 
 void FunctionGenImpl::changeIntegerSign(
@@ -303,25 +528,50 @@ void FunctionGenImpl::changeIntegerSign(
 void FunctionGenImpl::expandIntegerSigned(
         ExpressionId id, ExpressionId source, StaticType::CPtr sourceType, StaticType::CPtr destType )
 {
-    addExpression( id, LLVMBuildSExt(builder, lookupExpression(source), toLLVMType(destType), "") );
+    expandIntegerSigned( id, source, toLLVMType(destType) );
+}
+
+void FunctionGenImpl::expandIntegerSigned( ExpressionId id, ExpressionId source, LLVMTypeRef destType ) {
+    addExpression( id, LLVMBuildSExt(builder, lookupExpression(source), destType, "") );
 }
 
 void FunctionGenImpl::expandIntegerUnsigned(
         ExpressionId id, ExpressionId source, StaticType::CPtr sourceType, StaticType::CPtr destType )
 {
-    addExpression( id, LLVMBuildZExt(builder, lookupExpression(source), toLLVMType(destType), "") );
+    expandIntegerUnsigned( id, source, toLLVMType(destType) );
+}
+
+void FunctionGenImpl::expandIntegerUnsigned( ExpressionId id, ExpressionId source, LLVMTypeRef destType ) {
+    addExpression( id, LLVMBuildZExt(builder, lookupExpression(source), destType, "") );
 }
 
 void FunctionGenImpl::callFunctionDirect(
         ExpressionId id, String name, Slice<const ExpressionId> arguments, StaticType::CPtr returnType )
 {
-    LLVMValueRef functionRef = LLVMGetNamedFunction(module->getLLVMModule(), toCStr(name));
+    LLVMValueRef functionRef = module->lookupFunction(llvmModule, toCStr(name));
     std::vector<LLVMValueRef> llvmArguments;
     llvmArguments.reserve(arguments.size());
     for( const auto &argument: arguments ) {
         llvmArguments.emplace_back( lookupExpression(argument) );
     }
+
+    if( strcmp( toCStr(name), "__builtin_coro_suspend" )==0 ) {
+        suspendCoroutine( id, LLVMGetReturnType( LLVMGlobalGetValueType(functionRef) ) );
+        return;
+    }
+
+    LLVMValueRef builtinValue = nullptr;
+    if( isBuiltin( toCStr(name) ) )
+        builtinValue = buildBuiltinCall(
+                builder, llvmModule, toCStr(name), llvmArguments, module->getBuiltinSignedness( toCStr(name) ),
+                LLVMGetReturnType( LLVMGlobalGetValueType(functionRef) ), fileName.c_str() );
+    if( builtinValue!=nullptr ) {
+        addExpression( id, builtinValue );
+        return;
+    }
+
     addExpression( id, LLVMBuildCall(builder, functionRef, llvmArguments.data(), llvmArguments.size(), "") );
+    module->noteCall( functionName, toCStr(name) );
 }
 
 void FunctionGenImpl::binaryOperatorPlusUnsigned(
@@ -439,7 +689,119 @@ LLVMValueRef FunctionGenImpl::lookupExpression(ExpressionId id) const {
 
 void FunctionGenImpl::addExpression( ExpressionId id, LLVMValueRef value ) {
     assert( expressionValuesTable.find(id)==expressionValuesTable.end() ); // Adding an already existing expression
-    expressionValuesTable[id] = value;
+    expressionValuesTable[id] = numberValue( value );
+}
+
+// Instructions whose value depends only on their operands, and that can run wherever their operands are available
+static bool isPure( LLVMValueRef instruction ) {
+    switch( LLVMGetInstructionOpcode(instruction) ) {
+    case LLVMAdd:
+    case LLVMSub:
+    case LLVMMul:
+    case LLVMUDiv:
+    case LLVMSDiv:
+    case LLVMURem:
+    case LLVMSRem:
+    case LLVMShl:
+    case LLVMLShr:
+    case LLVMAShr:
+    case LLVMAnd:
+    case LLVMOr:
+    case LLVMXor:
+    case LLVMICmp:
+    case LLVMTrunc:
+    case LLVMZExt:
+    case LLVMSExt:
+    case LLVMBitCast:
+    case LLVMSelect:
+    case LLVMGetElementPtr:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// A cast of a cast as a single cast of the original value, or null if the pair doesn't reduce to one
+static LLVMValueRef collapseCasts( LLVMBuilderRef builder, LLVMValueRef outer ) {
+    LLVMOpcode outerOpcode = LLVMGetInstructionOpcode(outer);
+    LLVMValueRef inner = LLVMGetOperand(outer, 0);
+    if( !LLVMIsAInstruction(inner) )
+        return nullptr;
+
+    LLVMOpcode innerOpcode = LLVMGetInstructionOpcode(inner);
+    LLVMValueRef source = LLVMGetOperand(inner, 0);
+    LLVMTypeRef destType = LLVMTypeOf(outer);
+    bool innerExtends = innerOpcode==LLVMZExt || innerOpcode==LLVMSExt;
+
+    switch( outerOpcode ) {
+    case LLVMTrunc:
+        if( innerOpcode==LLVMTrunc )
+            return LLVMBuildTrunc( builder, source, destType, "" );
+        if( !innerExtends )
+            return nullptr;
+
+        // Narrower than the source: the extension's bits are all truncated away. Wider: extend the source directly.
+        // The same width folds to the source by simplification
+        if( LLVMGetIntTypeWidth(destType) < LLVMGetIntTypeWidth( LLVMTypeOf(source) ) )
+            return LLVMBuildTrunc( builder, source, destType, "" );
+        return LLVMBuildCast( builder, innerOpcode, source, destType, "" );
+    case LLVMZExt:
+        return innerOpcode==LLVMZExt ? LLVMBuildZExt( builder, source, destType, "" ) : nullptr;
+    case LLVMSExt:
+        // The sign of a zero extended value is 0, so it extends the same either way
+        return innerExtends ? LLVMBuildCast( builder, innerOpcode, source, destType, "" ) : nullptr;
+    default:
+        return nullptr;
+    }
+}
+
+// Cheap local cleanup of expression values as they are built, so that redundant instructions never reach the optimizer
+// or, when not optimizing, the code generator: pure instructions simplify to an existing value if they can (this
+// includes folding constants), casts of casts collapse into one cast, and an instruction identical to one earlier in
+// the same block is replaced by it. The new instruction is erased when replaced
+LLVMValueRef FunctionGenImpl::numberValue( LLVMValueRef value ) {
+    if( !LLVMIsAInstruction(value) || !isPure(value) )
+        return value;
+
+    size_t hash = std::hash<int>()( LLVMGetInstructionOpcode(value) );
+    auto combine = [&hash]( const void *pointer ) {
+        hash = hash*31 + std::hash<const void *>()( pointer );
+    };
+    combine( LLVMGetInstructionParent(value) );
+    for( int i=0; i<LLVMGetNumOperands(value); ++i ) {
+        combine( LLVMGetOperand(value, i) );
+    }
+
+    auto candidates = valueNumbers.equal_range( hash );
+    for( auto candidate = candidates.first; candidate!=candidates.second; ++candidate ) {
+        // Already numbered, i.e. the value of another expression too
+        if( candidate->second==value )
+            return value;
+    }
+
+    // Instructions that something other than the expression about to be added already uses can't be erased
+    if( LLVMGetFirstUse(value)!=nullptr )
+        return value;
+
+    LLVMValueRef replacement = simplifyInstruction( value );
+    for( auto candidate = candidates.first; replacement==nullptr && candidate!=candidates.second; ++candidate ) {
+        if( computesSameValue( candidate->second, value ) )
+            replacement = candidate->second;
+    }
+
+    if( replacement==nullptr ) {
+        replacement = collapseCasts( builder, value );
+        if( replacement==nullptr ) {
+            valueNumbers.emplace( hash, value );
+            return value;
+        }
+
+        LLVMInstructionEraseFromParent( value );
+        return numberValue( replacement );
+    }
+
+    LLVMInstructionEraseFromParent( value );
+    return replacement;
 }
 
 LLVMBasicBlockRef FunctionGenImpl::addBlock( const std::string &label ) {
@@ -460,6 +822,1093 @@ void FunctionGenImpl::setCurrentBlock( LLVMBasicBlockRef newCurrentBlock ) {
     LLVMPositionBuilderAtEnd(builder, currentBlock);
 }
 
+LLVMValueRef FunctionGenImpl::buildAlloca( LLVMTypeRef type, String name ) {
+    LLVMPositionBuilderBefore( builder, entryBranch );
+    LLVMValueRef ret = LLVMBuildAlloca( builder, type, toCStr(name) );
+    LLVMSetAlignment( ret, module->typeAlignment(type) );
+    LLVMPositionBuilderAtEnd( builder, currentBlock );
+
+    return ret;
+}
+
+JumpPointData &FunctionGenImpl::lookupJumpPoint( JumpPointId id, JumpPointData::Type type, const std::string &label ) {
+    auto iter = jumpPointsTable.find( id );
+    if( iter!=jumpPointsTable.end() )
+        return iter->second;
+
+    if( type==JumpPointData::Type::Label ) {
+        return jumpPointsTable.emplace(
+                std::piecewise_construct, std::forward_as_tuple( id ), std::forward_as_tuple( label ) ).first->second;
+    }
+
+    return jumpPointsTable.emplace(
+            std::piecewise_construct, std::forward_as_tuple( id ), std::forward_as_tuple( type ) ).first->second;
+}
+
+LLVMBasicBlockRef FunctionGenImpl::jumpPointBlock( JumpPointData &point ) {
+    if( point.block==nullptr ) {
+        // Forward reference. The block is moved to its proper place once the point is defined
+        point.block = LLVMAppendBasicBlock( llvmFunction, point.getLabel().c_str() );
+    }
+
+    return point.block;
+}
+
+void FunctionGenImpl::closeBlock( LLVMBasicBlockRef continuation ) {
+    if( currentBlock!=deadBlock ) {
+        LLVMBuildBr( builder, continuation );
+        return;
+    }
+
+    // Nothing reaches the current block. Don't give the continuation a bogus predecessor.
+    if( LLVMGetFirstInstruction(deadBlock)==nullptr ) {
+        LLVMDeleteBasicBlock( deadBlock );
+        currentBlock = nullptr;
+    } else {
+        LLVMBuildUnreachable( builder );
+    }
+
+    deadBlock = nullptr;
+}
+
+void FunctionGenImpl::startDeadBlock() {
+    deadBlock = addBlock();
+}
+
+void FunctionGenImpl::noteTailCall( LLVMValueRef ret ) {
+    tailCalls.emplace_back( TailCallData{ .call = LLVMGetPreviousInstruction(ret), .ret = ret } );
+}
+
+static bool isMemoryIntrinsic( LLVMValueRef call ) {
+    static const unsigned memcpyId = LLVMLookupIntrinsicID( "llvm.memcpy", strlen("llvm.memcpy") );
+    static const unsigned memsetId = LLVMLookupIntrinsicID( "llvm.memset", strlen("llvm.memset") );
+
+    LLVMValueRef callee = LLVMGetCalledValue(call);
+    if( !LLVMIsAFunction(callee) )
+        return false;
+
+    unsigned id = LLVMGetIntrinsicID(callee);
+    return id!=0 && ( id==memcpyId || id==memsetId );
+}
+
+// Whether the pointer, or one derived from it, is used other than to access the memory it points to
+static bool addressEscapes( LLVMValueRef pointer ) {
+    for( LLVMUseRef use = LLVMGetFirstUse(pointer); use!=nullptr; use = LLVMGetNextUse(use) ) {
+        LLVMValueRef user = LLVMGetUser(use);
+        if( LLVMIsALoadInst(user) )
+            continue;
+        if( LLVMIsAStoreInst(user) && LLVMGetOperand(user, 0)!=pointer )
+            continue;
+        if( LLVMIsACallInst(user) && isMemoryIntrinsic(user) )
+            continue;
+        if( ( LLVMIsAGetElementPtrInst(user) || LLVMIsABitCastInst(user) ) && !addressEscapes(user) )
+            continue;
+
+        return true;
+    }
+
+    return false;
+}
+
+// Tail calls release the caller's frame before the callee runs, so they are only possible if nothing outside the
+// function may hold the address of one of its stack variables
+bool FunctionGenImpl::stackAddressEscapes() const {
+    for(
+            LLVMValueRef instruction = LLVMGetFirstInstruction( LLVMGetEntryBasicBlock(llvmFunction) );
+            instruction!=nullptr;
+            instruction = LLVMGetNextInstruction(instruction) )
+    {
+        if( LLVMIsAAllocaInst(instruction) && addressEscapes(instruction) )
+            return true;
+    }
+
+    return false;
+}
+
+void FunctionGenImpl::lowerTailCalls() {
+    if( tailCalls.empty() )
+        return;
+
+    bool mustTail = module->getOptions().mustTail;
+    if( stackAddressEscapes() ) {
+        if( mustTail ) {
+            std::string msg = "Function " + functionName +
+                    " passes addresses of its local variables, so its calls in tail position can't be made musttail";
+            emitMsg(MsgLevel::Error, fileName.c_str(), msg.c_str());
+            exit(1);
+        }
+
+        return;
+    }
+
+    LLVMTypeRef functionType = LLVMGlobalGetValueType(llvmFunction);
+    for( const TailCallData &tailCall : tailCalls ) {
+        LLVMValueRef callee = LLVMGetCalledValue(tailCall.call);
+
+        if( callee==llvmFunction ) {
+            // Self recursion: assign the new arguments and go back to the start of the function, turning the
+            // recursion into a loop regardless of optimization level
+            if( tailRecursionLatch==nullptr ) {
+                tailRecursionLatch = LLVMAppendBasicBlock( llvmFunction, "tailrecurse" );
+                LLVMPositionBuilderAtEnd( builder, tailRecursionLatch );
+                LLVMBuildBr( builder, bodyBlock );
+
+                loops.emplace_back( LoopData{ .header = bodyBlock, .latch = tailRecursionLatch } );
+            }
+
+            LLVMPositionBuilderBefore( builder, tailCall.call );
+            for( unsigned i=0; i<argumentSlots.size(); ++i ) {
+                setAccessType( LLVMBuildStore( builder, LLVMGetOperand(tailCall.call, i), argumentSlots[i] ) );
+            }
+            LLVMBuildBr( builder, tailRecursionLatch );
+
+            LLVMInstructionEraseFromParent( tailCall.ret );
+            LLVMInstructionEraseFromParent( tailCall.call );
+        } else if( mustTail ) {
+            if( !LLVMIsAFunction(callee) || LLVMGlobalGetValueType(callee)!=functionType ) {
+                std::string msg = "Function " + functionName + " has a call in tail position to a function with a "
+                        "different prototype, which can't be made musttail";
+                emitMsg(MsgLevel::Error, fileName.c_str(), msg.c_str());
+                exit(1);
+            }
+
+            setMustTailCall( tailCall.call );
+        } else {
+            LLVMSetTailCall( tailCall.call, true );
+        }
+    }
+}
+
+// Can the instruction run even when its result isn't needed, and is it cheap enough to do so?
+static bool isSpeculatable( LLVMValueRef instruction ) {
+    switch( LLVMGetInstructionOpcode(instruction) ) {
+    case LLVMAdd:
+    case LLVMSub:
+    case LLVMMul:
+    case LLVMAnd:
+    case LLVMOr:
+    case LLVMXor:
+    case LLVMICmp:
+    case LLVMTrunc:
+    case LLVMZExt:
+    case LLVMSExt:
+    case LLVMSelect:
+    case LLVMGetElementPtr:
+        // At worst these produce poison, which select discards if the clause isn't chosen
+        return true;
+    case LLVMUDiv:
+    case LLVMURem:
+        {
+            // Division by zero is undefined behavior, so only speculate division by a known non-zero constant
+            LLVMValueRef divisor = LLVMGetOperand(instruction, 1);
+            return LLVMIsAConstantInt(divisor) && LLVMConstIntGetZExtValue(divisor)!=0;
+        }
+    default:
+        // Loads (the pointer may be invalid when the condition is false), stores, calls, control flow
+        return false;
+    }
+}
+
+// Total instructions both clauses may hold and still be turned into a select when not forced
+static constexpr unsigned MaxSpeculatedInstructions = 4;
+
+bool FunctionGenImpl::foldToSelect( BranchPointData &branch ) {
+    ConditionalLowering lowering = module->getOptions().conditionalLowering;
+    if( lowering==ConditionalLowering::Branch )
+        return false;
+
+    // Each clause must be a single block, i.e. have no control flow of its own
+    if( branch.phiBlocks[0]!=branch.ifBlock || branch.phiBlocks[1]!=branch.elsePointBlock )
+        return false;
+
+    LLVMBasicBlockRef clauses[2] = { branch.ifBlock, branch.elsePointBlock };
+    unsigned numInstructions = 0;
+    for( LLVMBasicBlockRef clause : clauses ) {
+        LLVMValueRef terminator = LLVMGetBasicBlockTerminator(clause);
+        for(
+                LLVMValueRef instruction = LLVMGetFirstInstruction(clause);
+                instruction!=terminator;
+                instruction = LLVMGetNextInstruction(instruction) )
+        {
+            if( !isSpeculatable(instruction) )
+                return false;
+            ++numInstructions;
+        }
+    }
+
+    if( lowering==ConditionalLowering::Auto && numInstructions>MaxSpeculatedInstructions )
+        return false;
+
+    // Hoist both clauses in front of the conditional branch, and replace it with a select
+    LLVMBasicBlockRef conditionBlock = LLVMGetInstructionParent( branch.branchInstruction );
+    for( LLVMBasicBlockRef clause : clauses ) {
+        LLVMValueRef terminator = LLVMGetBasicBlockTerminator(clause);
+        LLVMValueRef instruction = LLVMGetFirstInstruction(clause);
+        while( instruction!=terminator ) {
+            LLVMValueRef next = LLVMGetNextInstruction(instruction);
+            LLVMInstructionRemoveFromParent( instruction );
+            LLVMPositionBuilderBefore( builder, branch.branchInstruction );
+            LLVMInsertIntoBuilder( builder, instruction );
+            instruction = next;
+        }
+    }
+
+    LLVMValueRef condition = LLVMGetCondition( branch.branchInstruction );
+    LLVMInstructionEraseFromParent( branch.branchInstruction );
+    LLVMDeleteBasicBlock( branch.ifBlock );
+    LLVMDeleteBasicBlock( branch.elsePointBlock );
+    LLVMDeleteBasicBlock( branch.continuationPointBlock );
+    jumpPointsTable.at( branch.continuationPointId ).block = conditionBlock;
+
+    setCurrentBlock( conditionBlock );
+    addExpression(
+            branch.conditionValue,
+            LLVMBuildSelect(
+                builder, condition, lookupExpression(branch.ifBlockValue), lookupExpression(branch.elseBlockValue),
+                "" ) );
+
+    return true;
+}
+
+using BlockPredecessors = std::unordered_map< LLVMBasicBlockRef, std::vector<LLVMBasicBlockRef> >;
+
+// The loop's body is everything that reaches the latch without going through the header
+static std::unordered_set<LLVMBasicBlockRef> loopBody( const LoopData &loop, BlockPredecessors &predecessors ) {
+    std::unordered_set<LLVMBasicBlockRef> body{ loop.header };
+    std::vector<LLVMBasicBlockRef> pending{ loop.latch };
+    while( !pending.empty() ) {
+        LLVMBasicBlockRef block = pending.back();
+        pending.pop_back();
+
+        if( !body.insert( block ).second )
+            continue;
+
+        for( LLVMBasicBlockRef predecessor : predecessors[block] )
+            pending.push_back( predecessor );
+    }
+
+    return body;
+}
+
+// Give every block the loop exits to that is also entered from outside the loop a block of its own, that only the loop
+// branches to. Phis of the exit block take the loop's values through a phi in the new block.
+static void insertDedicatedExits(
+        LLVMBuilderRef builder, LLVMValueRef function, const std::unordered_set<LLVMBasicBlockRef> &body,
+        BlockPredecessors &predecessors )
+{
+    for(
+            LLVMBasicBlockRef exit = LLVMGetFirstBasicBlock(function);
+            exit!=nullptr;
+            exit = LLVMGetNextBasicBlock(exit) )
+    {
+        if( body.count(exit)!=0 )
+            continue;
+
+        std::vector<LLVMBasicBlockRef> inside, outside;
+        for( LLVMBasicBlockRef predecessor : predecessors[exit] ) {
+            auto &side = body.count(predecessor)!=0 ? inside : outside;
+            if( std::find( side.begin(), side.end(), predecessor )==side.end() )
+                side.push_back( predecessor );
+        }
+
+        if( inside.empty() || outside.empty() )
+            continue;
+
+        LLVMBasicBlockRef dedicated = LLVMInsertBasicBlock( exit, "loopexit" );
+        for( LLVMBasicBlockRef block : inside ) {
+            LLVMValueRef terminator = LLVMGetBasicBlockTerminator(block);
+            for( unsigned i=0; i<LLVMGetNumSuccessors(terminator); ++i ) {
+                if( LLVMGetSuccessor(terminator, i)==exit )
+                    LLVMSetSuccessor( terminator, i, dedicated );
+            }
+        }
+
+        LLVMValueRef phi = LLVMGetFirstInstruction(exit);
+        while( phi!=nullptr && LLVMIsAPHINode(phi) ) {
+            LLVMValueRef next = LLVMGetNextInstruction(phi);
+
+            std::vector<LLVMValueRef> insideValues, outsideValues;
+            std::vector<LLVMBasicBlockRef> insideBlocks, outsideBlocks;
+            for( unsigned i=0; i<LLVMCountIncoming(phi); ++i ) {
+                LLVMBasicBlockRef block = LLVMGetIncomingBlock(phi, i);
+                bool fromLoop = body.count(block)!=0;
+                ( fromLoop ? insideValues : outsideValues ).push_back( LLVMGetIncomingValue(phi, i) );
+                ( fromLoop ? insideBlocks : outsideBlocks ).push_back( block );
+            }
+
+            LLVMPositionBuilderAtEnd( builder, dedicated );
+            LLVMValueRef insidePhi = LLVMBuildPhi( builder, LLVMTypeOf(phi), "" );
+            LLVMAddIncoming( insidePhi, insideValues.data(), insideBlocks.data(), insideValues.size() );
+
+            outsideValues.push_back( insidePhi );
+            outsideBlocks.push_back( dedicated );
+            LLVMPositionBuilderBefore( builder, phi );
+            LLVMValueRef exitPhi = LLVMBuildPhi( builder, LLVMTypeOf(phi), "" );
+            LLVMAddIncoming( exitPhi, outsideValues.data(), outsideBlocks.data(), outsideValues.size() );
+
+            LLVMReplaceAllUsesWith( phi, exitPhi );
+            LLVMInstructionEraseFromParent( phi );
+            phi = next;
+        }
+
+        LLVMPositionBuilderAtEnd( builder, dedicated );
+        LLVMBuildBr( builder, exit );
+
+        predecessors[dedicated] = inside;
+        outside.push_back( dedicated );
+        predecessors[exit] = std::move(outside);
+    }
+}
+
+void FunctionGenImpl::finalizeLoops() {
+    if( loops.empty() )
+        return;
+
+    BlockPredecessors predecessors;
+    for(
+            LLVMBasicBlockRef block = LLVMGetFirstBasicBlock(llvmFunction);
+            block!=nullptr;
+            block = LLVMGetNextBasicBlock(block) )
+    {
+        LLVMValueRef terminator = LLVMGetBasicBlockTerminator(block);
+        unsigned numSuccessors = terminator!=nullptr ? LLVMGetNumSuccessors(terminator) : 0;
+        for( unsigned i=0; i<numSuccessors; ++i ) {
+            predecessors[ LLVMGetSuccessor(terminator, i) ].push_back( block );
+        }
+    }
+
+    // Loops are listed in the order their first back edge was generated, so inner loops come before the loops around
+    // them, and the exit blocks added for an inner loop are part of the loops around it
+    for( const LoopData &loop : loops ) {
+        insertDedicatedExits( builder, llvmFunction, loopBody( loop, predecessors ), predecessors );
+    }
+
+    const LoopHints &hints = module->getOptions().loopHints;
+    if( !hints.any() )
+        return;
+
+    LLVMContextRef ctx = LLVMGetGlobalContext();
+
+    auto mdString = [ctx]( const char *str ) {
+        return LLVMMDStringInContext2( ctx, str, strlen(str) );
+    };
+    auto mdProperty = [&]( const char *name, LLVMValueRef value ) {
+        LLVMMetadataRef operands[2] = { mdString(name), LLVMValueAsMetadata(value) };
+        return LLVMMDNodeInContext2( ctx, operands, 2 );
+    };
+
+    // Memory instructions of nested loops belong to the access groups of all enclosing loops
+    std::unordered_map< LLVMValueRef, std::vector<LLVMMetadataRef> > accessGroups;
+
+    for( const LoopData &loop : loops ) {
+        std::vector<LLVMMetadataRef> properties;
+
+        if( hints.unrollCount!=0 ) {
+            properties.push_back(
+                    mdProperty( "llvm.loop.unroll.count", LLVMConstInt( LLVMInt32Type(), hints.unrollCount, false ) ) );
+        }
+
+        if( hints.vectorizeWidth!=0 ) {
+            properties.push_back(
+                    mdProperty(
+                        "llvm.loop.vectorize.width", LLVMConstInt( LLVMInt32Type(), hints.vectorizeWidth, false ) ) );
+            properties.push_back(
+                    mdProperty(
+                        "llvm.loop.vectorize.enable", LLVMConstInt( LLVMInt1Type(), hints.vectorizeWidth>1, false ) ) );
+        }
+
+        if( hints.noAlias ) {
+            LLVMMetadataRef accessGroup = createDistinctMDNode( ctx, nullptr, 0 );
+            LLVMMetadataRef operands[2] = { mdString("llvm.loop.parallel_accesses"), accessGroup };
+            properties.push_back( LLVMMDNodeInContext2( ctx, operands, 2 ) );
+
+            for( LLVMBasicBlockRef block : loopBody( loop, predecessors ) ) {
+                for(
+                        LLVMValueRef instruction = LLVMGetFirstInstruction(block);
+                        instruction!=nullptr;
+                        instruction = LLVMGetNextInstruction(instruction) )
+                {
+                    LLVMOpcode opcode = LLVMGetInstructionOpcode(instruction);
+                    if( opcode==LLVMLoad || opcode==LLVMStore )
+                        accessGroups[instruction].push_back( accessGroup );
+                }
+            }
+        }
+
+        LLVMMetadataRef loopId = createLoopID( ctx, properties.data(), properties.size() );
+        LLVMSetMetadata(
+                LLVMGetBasicBlockTerminator( loop.latch ),
+                LLVMGetMDKindID( "llvm.loop", strlen("llvm.loop") ),
+                LLVMMetadataAsValue( ctx, loopId ) );
+    }
+
+    unsigned accessGroupKind = LLVMGetMDKindID( "llvm.access.group", strlen("llvm.access.group") );
+    for( auto &instructionGroups : accessGroups ) {
+        auto &groups = instructionGroups.second;
+        LLVMMetadataRef md = groups.size()==1 ? groups[0] : LLVMMDNodeInContext2( ctx, groups.data(), groups.size() );
+        LLVMSetMetadata( instructionGroups.first, accessGroupKind, LLVMMetadataAsValue( ctx, md ) );
+    }
+}
+
+// Aggregates at least this large are copied with memcpy. Smaller ones are copied in a single wide integer move if
+// their size allows it, and field by field otherwise
+static constexpr unsigned long long AggregateMemcpyThreshold = 32;
+// Widest integer move used to copy an aggregate, and to coalesce stores into
+static constexpr unsigned long long MaxWideMove = 8;
+
+// Alignment of the address offset bytes past one aligned to alignment
+static unsigned offsetAlignment( unsigned alignment, unsigned long long offset ) {
+    unsigned long long combined = alignment | offset;
+    return combined & -combined;
+}
+
+// Tag a load or store with the TBAA type of the value it accesses. Wide moves that reinterpret memory as a different
+// type must not be tagged
+void FunctionGenImpl::setAccessType( LLVMValueRef instruction, LLVMTypeRef containerType, unsigned long long offset ) {
+    LLVMTypeRef accessType = LLVMIsAStoreInst(instruction) ?
+            LLVMTypeOf( LLVMGetOperand(instruction, 0) ) :
+            LLVMTypeOf(instruction);
+
+    LLVMMetadataRef tag = module->tbaaAccessTag( accessType, containerType, offset );
+    if( tag!=nullptr ) {
+        static const unsigned tbaaKind = LLVMGetMDKindID( "tbaa", strlen("tbaa") );
+        LLVMSetMetadata( instruction, tbaaKind, LLVMMetadataAsValue( LLVMGetGlobalContext(), tag ) );
+    }
+}
+
+// Whether the memory a load read still holds the loaded value at the insertion point, so it can be copied from there
+bool FunctionGenImpl::loadedValueUnchanged( LLVMValueRef load ) const {
+    if( LLVMGetInstructionParent(load)!=LLVMGetInsertBlock(builder) )
+        return false;
+
+    for( LLVMValueRef instruction = LLVMGetNextInstruction(load); instruction!=nullptr;
+            instruction = LLVMGetNextInstruction(instruction) )
+    {
+        if( mayWriteMemory(instruction) )
+            return false;
+    }
+
+    return true;
+}
+
+// First class aggregate loads and stores are slow to compile and generate poor code, so aggregate assignments are
+// turned into memory to memory copies
+void FunctionGenImpl::storeAggregate( LLVMValueRef address, LLVMValueRef value ) {
+    LLVMTypeRef type = LLVMTypeOf(value);
+    unsigned alignment = LLVMABIAlignmentOfType( LLVMGetModuleDataLayout(llvmModule), type );
+
+    if( LLVMIsALoadInst(value) && loadedValueUnchanged(value) ) {
+        copyMemory( address, LLVMGetOperand(value, 0), type, std::min( alignment, LLVMGetAlignment(value) ) );
+    } else if( LLVMIsNull(value) ) {
+        storeZero( address, type, alignment );
+    } else {
+        LLVMBuildStore( builder, value, address );
+    }
+}
+
+void FunctionGenImpl::copyMemory(
+        LLVMValueRef destination, LLVMValueRef source, LLVMTypeRef type, unsigned alignment,
+        LLVMTypeRef containerType, unsigned long long offset )
+{
+    if( !isAggregate(type) ) {
+        LLVMValueRef value = LLVMBuildLoad2( builder, type, source, "" );
+        LLVMSetAlignment( value, alignment );
+        setAccessType( value, containerType, offset );
+        LLVMValueRef store = LLVMBuildStore( builder, value, destination );
+        LLVMSetAlignment( store, alignment );
+        setAccessType( store, containerType, offset );
+
+        return;
+    }
+
+    LLVMTargetDataRef dataLayout = LLVMGetModuleDataLayout(llvmModule);
+    unsigned long long size = LLVMABISizeOfType( dataLayout, type );
+
+    if( size>=AggregateMemcpyThreshold ) {
+        LLVMBuildMemCpy(
+                builder, destination, alignment, source, alignment, LLVMConstInt( LLVMInt64Type(), size, false ) );
+        return;
+    }
+
+    if( storeWide( destination, source, type, alignment ) )
+        return;
+
+    LLVMValueRef zero = LLVMConstInt( LLVMInt32Type(), 0, false );
+    if( LLVMGetTypeKind(type)==LLVMStructTypeKind ) {
+        for( unsigned i=0; i<LLVMCountStructElementTypes(type); ++i ) {
+            unsigned long long fieldOffset = LLVMOffsetOfElement( dataLayout, type, i );
+            copyMemory(
+                    LLVMBuildStructGEP2( builder, type, destination, i, "" ),
+                    LLVMBuildStructGEP2( builder, type, source, i, "" ),
+                    LLVMStructGetTypeAtIndex( type, i ),
+                    offsetAlignment( alignment, fieldOffset ),
+                    type, fieldOffset );
+        }
+    } else {
+        LLVMTypeRef elementType = LLVMGetElementType(type);
+        unsigned long long elementSize = LLVMABISizeOfType( dataLayout, elementType );
+        for( unsigned i=0; i<LLVMGetArrayLength(type); ++i ) {
+            LLVMValueRef indexes[2] = { zero, LLVMConstInt( LLVMInt32Type(), i, false ) };
+            copyMemory(
+                    LLVMBuildInBoundsGEP2( builder, type, destination, indexes, 2, "" ),
+                    LLVMBuildInBoundsGEP2( builder, type, source, indexes, 2, "" ),
+                    elementType,
+                    offsetAlignment( alignment, i*elementSize ) );
+        }
+    }
+}
+
+void FunctionGenImpl::storeZero( LLVMValueRef address, LLVMTypeRef type, unsigned alignment ) {
+    LLVMTargetDataRef dataLayout = LLVMGetModuleDataLayout(llvmModule);
+    unsigned long long size = LLVMABISizeOfType( dataLayout, type );
+
+    if( size>=AggregateMemcpyThreshold ) {
+        LLVMBuildMemSet(
+                builder, address, LLVMConstInt( LLVMInt8Type(), 0, false ),
+                LLVMConstInt( LLVMInt64Type(), size, false ), alignment );
+        return;
+    }
+
+    if( storeWide( address, nullptr, type, alignment ) )
+        return;
+
+    // Split into field stores, which coalesceStores merges where possible
+    LLVMValueRef zero = LLVMConstInt( LLVMInt32Type(), 0, false );
+    if( LLVMGetTypeKind(type)==LLVMStructTypeKind ) {
+        for( unsigned i=0; i<LLVMCountStructElementTypes(type); ++i ) {
+            LLVMValueRef field = LLVMBuildStructGEP2( builder, type, address, i, "" );
+            LLVMTypeRef fieldType = LLVMStructGetTypeAtIndex( type, i );
+            unsigned long long fieldOffset = LLVMOffsetOfElement( dataLayout, type, i );
+            unsigned fieldAlignment = offsetAlignment( alignment, fieldOffset );
+
+            if( isAggregate(fieldType) ) {
+                storeZero( field, fieldType, fieldAlignment );
+            } else {
+                LLVMValueRef store = LLVMBuildStore( builder, LLVMConstNull(fieldType), field );
+                LLVMSetAlignment( store, fieldAlignment );
+                setAccessType( store, type, fieldOffset );
+            }
+        }
+    } else {
+        LLVMTypeRef elementType = LLVMGetElementType(type);
+        unsigned long long elementSize = LLVMABISizeOfType( dataLayout, elementType );
+        for( unsigned i=0; i<LLVMGetArrayLength(type); ++i ) {
+            LLVMValueRef indexes[2] = { zero, LLVMConstInt( LLVMInt32Type(), i, false ) };
+            LLVMValueRef element = LLVMBuildInBoundsGEP2( builder, type, address, indexes, 2, "" );
+            unsigned elementAlignment = offsetAlignment( alignment, i*elementSize );
+
+            if( isAggregate(elementType) ) {
+                storeZero( element, elementType, elementAlignment );
+            } else {
+                LLVMValueRef store = LLVMBuildStore( builder, LLVMConstNull(elementType), element );
+                LLVMSetAlignment( store, elementAlignment );
+                setAccessType( store );
+            }
+        }
+    }
+}
+
+// Copy (or zero, if source is null) an aggregate whose size is that of an integer register with a single integer move
+bool FunctionGenImpl::storeWide( LLVMValueRef destination, LLVMValueRef source, LLVMTypeRef type, unsigned alignment ) {
+    unsigned long long size = LLVMABISizeOfType( LLVMGetModuleDataLayout(llvmModule), type );
+    if( size>MaxWideMove || (size & (size-1))!=0 )
+        return false;
+
+    LLVMTypeRef wideType = LLVMIntType( size*8 );
+    LLVMTypeRef widePointer = LLVMPointerType( wideType, 0 );
+
+    LLVMValueRef value;
+    if( source!=nullptr ) {
+        value = LLVMBuildLoad2( builder, wideType, LLVMBuildBitCast( builder, source, widePointer, "" ), "" );
+        LLVMSetAlignment( value, alignment );
+    } else {
+        value = LLVMConstNull( wideType );
+    }
+
+    LLVMValueRef store = LLVMBuildStore( builder, value, LLVMBuildBitCast( builder, destination, widePointer, "" ) );
+    LLVMSetAlignment( store, alignment );
+
+    return true;
+}
+
+void FunctionGenImpl::eraseDeadAggregateLoads() {
+    for( LLVMValueRef load : aggregateLoads ) {
+        if( LLVMGetFirstUse(load)==nullptr )
+            LLVMInstructionEraseFromParent( load );
+    }
+}
+
+// A run of constant integer stores to consecutive bytes, with nothing touching memory in between
+struct StoreRun {
+    LLVMValueRef base = nullptr;
+    int64_t start = 0, end = 0;
+    uint64_t value = 0;
+    std::vector<LLVMValueRef> stores;
+};
+
+// Merge adjacent constant stores (e.g. from zeroing a struct field by field) into wider ones
+void FunctionGenImpl::coalesceStores() {
+    LLVMTargetDataRef dataLayout = LLVMGetModuleDataLayout(llvmModule);
+    if( LLVMByteOrder(dataLayout)!=LLVMLittleEndian )
+        return;
+
+    auto flush = [&]( StoreRun &run ) {
+        unsigned long long size = run.end - run.start;
+        if( run.stores.size()>1 && (size & (size-1))==0 ) {
+            LLVMValueRef first = run.stores[0];
+            LLVMTypeRef wideType = LLVMIntType( size*8 );
+
+            LLVMPositionBuilderBefore( builder, run.stores.back() );
+            LLVMValueRef address =
+                    LLVMBuildBitCast( builder, LLVMGetOperand(first, 1), LLVMPointerType( wideType, 0 ), "" );
+            LLVMValueRef store = LLVMBuildStore( builder, LLVMConstInt( wideType, run.value, false ), address );
+            LLVMSetAlignment( store, LLVMGetAlignment(first) );
+
+            for( LLVMValueRef oldStore : run.stores ) {
+                LLVMValueRef oldAddress = LLVMGetOperand(oldStore, 1);
+                LLVMInstructionEraseFromParent( oldStore );
+
+                if( LLVMIsAInstruction(oldAddress) && !LLVMIsAAllocaInst(oldAddress) &&
+                        LLVMGetFirstUse(oldAddress)==nullptr )
+                    LLVMInstructionEraseFromParent( oldAddress );
+            }
+        }
+
+        run = StoreRun();
+    };
+
+    for( LLVMBasicBlockRef block = LLVMGetFirstBasicBlock(llvmFunction); block!=nullptr;
+            block = LLVMGetNextBasicBlock(block) )
+    {
+        StoreRun run;
+        LLVMValueRef instruction = LLVMGetFirstInstruction(block);
+        while( instruction!=nullptr ) {
+            LLVMValueRef next = LLVMGetNextInstruction(instruction);
+
+            if( LLVMIsAStoreInst(instruction) && LLVMIsAConstantInt( LLVMGetOperand(instruction, 0) ) ) {
+                LLVMValueRef value = LLVMGetOperand(instruction, 0);
+                LLVMTypeRef type = LLVMTypeOf(value);
+                unsigned width = LLVMGetIntTypeWidth(type);
+                int64_t offset;
+                LLVMValueRef base = stripConstantOffsets( LLVMGetOperand(instruction, 1), dataLayout, &offset );
+
+                if( width%8!=0 || width>MaxWideMove*8 || LLVMGetVolatile(instruction) ||
+                        LLVMGetOrdering(instruction)!=LLVMAtomicOrderingNotAtomic )
+                {
+                    flush( run );
+                    instruction = next;
+                    continue;
+                }
+
+                if( run.base!=base || run.end!=offset ||
+                        static_cast<uint64_t>( run.end+width/8-run.start )>MaxWideMove )
+                {
+                    flush( run );
+                }
+
+                if( run.base==nullptr ) {
+                    run.base = base;
+                    run.start = run.end = offset;
+                }
+
+                run.value |= LLVMConstIntGetZExtValue(value) << ( (run.end-run.start)*8 );
+                run.end += width/8;
+                run.stores.push_back( instruction );
+            } else if( mayAccessMemory(instruction) || LLVMIsATerminatorInst(instruction) ) {
+                flush( run );
+            }
+
+            instruction = next;
+        }
+
+        flush( run );
+    }
+}
+
+// Calls one of the timing runtime's probes with the cycle counter. Probes in return paths keep calls in tail position
+// from becoming tail calls, as the probe must run after them
+void FunctionGenImpl::buildTimingProbe( const char *probeName ) {
+    LLVMTypeRef argumentTypes[] = { LLVMTypeOf(timingFunction), LLVMInt64Type() };
+    LLVMTypeRef probeType = LLVMFunctionType( LLVMVoidType(), argumentTypes, 2, false );
+
+    LLVMValueRef probe = LLVMGetNamedFunction( llvmModule, probeName );
+    if( probe==nullptr ) {
+        probe = LLVMAddFunction( llvmModule, probeName, probeType );
+        LLVMSetFunctionCallConv( probe, LLVMCCallConv );
+    }
+
+    LLVMValueRef arguments[] = { timingFunction, buildIntrinsic( "llvm.readcyclecounter", {}, {} ) };
+    LLVMBuildCall2( builder, probeType, probe, arguments, 2, "" );
+}
+
+LLVMValueRef FunctionGenImpl::buildIntrinsic(
+        const char *name, const std::vector<LLVMTypeRef> &overloads, const std::vector<LLVMValueRef> &arguments )
+{
+    unsigned id = LLVMLookupIntrinsicID( name, strlen(name) );
+    assert( id!=0 );
+
+    LLVMValueRef function = LLVMGetIntrinsicDeclaration(
+            llvmModule, id, const_cast<LLVMTypeRef *>( overloads.data() ), overloads.size() );
+    return LLVMBuildCall2(
+            builder, LLVMGlobalGetValueType(function), function, const_cast<LLVMValueRef *>( arguments.data() ),
+            arguments.size(), "" );
+}
+
+// Call the coroutine frame allocator or deallocator, declaring it if the module doesn't
+LLVMValueRef FunctionGenImpl::callFrameFunction( const std::string &name, LLVMTypeRef type, LLVMValueRef argument ) {
+    LLVMValueRef function = LLVMGetNamedFunction( llvmModule, name.c_str() );
+    if( function==nullptr )
+        function = LLVMAddFunction( llvmModule, name.c_str(), type );
+    else if( LLVMGlobalGetValueType(function)!=type )
+        function = LLVMConstBitCast( function, LLVMPointerType( type, 0 ) );
+
+    return LLVMBuildCall2( builder, type, function, &argument, 1, "" );
+}
+
+void FunctionGenImpl::beginCoroutine() {
+    LLVMTypeRef returnType = LLVMGetReturnType( LLVMGlobalGetValueType(llvmFunction) );
+    if( LLVMGetTypeKind(returnType)!=LLVMPointerTypeKind ) {
+        std::string msg = "Coroutine " + functionName + " must return a pointer, which becomes its handle";
+        emitMsg(MsgLevel::Error, fileName.c_str(), msg.c_str());
+        exit(1);
+    }
+
+    const CoroutineOptions &options = module->getOptions().coroutines;
+    LLVMTypeRef bytePointer = LLVMPointerType( LLVMInt8Type(), 0 ), int64Type = LLVMInt64Type();
+    LLVMValueRef null = LLVMConstNull( bytePointer );
+
+    // The frame is allocated unless the coroutine's lifetime is bounded by its caller's, in which case it lives in the
+    // caller's frame
+    LLVMBasicBlockRef entryBlock = LLVMGetInstructionParent( entryBranch );
+    LLVMInstructionEraseFromParent( entryBranch );
+    LLVMPositionBuilderAtEnd( builder, entryBlock );
+    coroutine.id = buildIntrinsic(
+            "llvm.coro.id", {}, { LLVMConstInt( LLVMInt32Type(), 0, false ), null, null, null } );
+    LLVMValueRef allocate = buildIntrinsic( "llvm.coro.alloc", {}, { coroutine.id } );
+
+    LLVMBasicBlockRef allocateBlock = LLVMAppendBasicBlock( llvmFunction, "coro.alloc" );
+    LLVMBasicBlockRef beginBlock = LLVMAppendBasicBlock( llvmFunction, "coro.begin" );
+    entryBranch = LLVMBuildCondBr( builder, allocate, allocateBlock, beginBlock );
+
+    LLVMPositionBuilderAtEnd( builder, allocateBlock );
+    LLVMValueRef frame = callFrameFunction(
+            options.allocator, LLVMFunctionType( bytePointer, &int64Type, 1, false ),
+            buildIntrinsic( "llvm.coro.size", { int64Type }, {} ) );
+    LLVMBuildBr( builder, beginBlock );
+
+    LLVMPositionBuilderAtEnd( builder, beginBlock );
+    LLVMValueRef memory = LLVMBuildPhi( builder, bytePointer, "" );
+    LLVMValueRef incomingValues[] = { null, frame };
+    LLVMBasicBlockRef incomingBlocks[] = { entryBlock, allocateBlock };
+    LLVMAddIncoming( memory, incomingValues, incomingBlocks, 2 );
+    coroutine.handle = buildIntrinsic( "llvm.coro.begin", {}, { coroutine.id, memory } );
+    LLVMBuildBr( builder, bodyBlock );
+
+    coroutine.finalBlock = LLVMAppendBasicBlock( llvmFunction, "coro.final" );
+    coroutine.cleanupBlock = LLVMAppendBasicBlock( llvmFunction, "coro.cleanup" );
+    coroutine.suspendBlock = LLVMAppendBasicBlock( llvmFunction, "coro.suspend" );
+
+    // Marks the function for splitting by the coroutine passes ("0": not prepared for splitting yet)
+    static const char preSplit[] = "coroutine.presplit";
+    LLVMAddAttributeAtIndex(
+            llvmFunction, LLVMAttributeFunctionIndex,
+            LLVMCreateStringAttribute( LLVMGetGlobalContext(), preSplit, strlen(preSplit), "0", 1 ) );
+
+    // Inlining the ramp (the part that runs up to the first suspension) into callers lets them elide the allocation
+    static const unsigned alwaysInline = LLVMGetEnumAttributeKindForName( "alwaysinline", strlen("alwaysinline") );
+    LLVMAddAttributeAtIndex(
+            llvmFunction, LLVMAttributeFunctionIndex,
+            LLVMCreateEnumAttribute( LLVMGetGlobalContext(), alwaysInline, 0 ) );
+}
+
+// state is the result of llvm.coro.suspend: 0 when resumed, 1 when destroyed and -1 when suspending
+void FunctionGenImpl::buildSuspendSwitch( LLVMValueRef state, LLVMBasicBlockRef resumeBlock ) {
+    LLVMValueRef dispatch = LLVMBuildSwitch( builder, state, coroutine.suspendBlock, 2 );
+    LLVMAddCase( dispatch, LLVMConstInt( LLVMInt8Type(), 0, false ), resumeBlock );
+    LLVMAddCase( dispatch, LLVMConstInt( LLVMInt8Type(), 1, false ), coroutine.cleanupBlock );
+}
+
+void FunctionGenImpl::suspendCoroutine( ExpressionId id, LLVMTypeRef returnType ) {
+    if( coroutine.id==nullptr ) {
+        std::string msg = "__builtin_coro_suspend called from " + functionName + ", which is not a coroutine";
+        emitMsg(MsgLevel::Error, fileName.c_str(), msg.c_str());
+        exit(1);
+    }
+    if( LLVMGetTypeKind(returnType)!=LLVMVoidTypeKind ) {
+        emitMsg(MsgLevel::Error, fileName.c_str(), "__builtin_coro_suspend must be declared as returning Void");
+        exit(1);
+    }
+
+    LLVMValueRef save = buildIntrinsic( "llvm.coro.save", {}, { coroutine.handle } );
+    LLVMValueRef state = buildIntrinsic(
+            "llvm.coro.suspend", {}, { save, LLVMConstInt( LLVMInt1Type(), 0, false ) } );
+    addExpression( id, state );
+
+    LLVMBasicBlockRef suspendingBlock = currentBlock;
+    LLVMBasicBlockRef resumeBlock = addBlock( "coro.resume" );
+    LLVMPositionBuilderAtEnd( builder, suspendingBlock );
+    buildSuspendSwitch( state, resumeBlock );
+    setCurrentBlock( resumeBlock );
+}
+
+void FunctionGenImpl::finishCoroutine() {
+    LLVMTypeRef bytePointer = LLVMPointerType( LLVMInt8Type(), 0 );
+
+    // The final suspension leaves the coroutine done. It may then only be destroyed
+    LLVMPositionBuilderAtEnd( builder, coroutine.finalBlock );
+    LLVMValueRef noSave = LLVMConstNull( LLVMTokenTypeInContext( LLVMGetGlobalContext() ) );
+    LLVMValueRef state = buildIntrinsic(
+            "llvm.coro.suspend", {}, { noSave, LLVMConstInt( LLVMInt1Type(), 1, false ) } );
+    LLVMBasicBlockRef resumedWhenDone = LLVMAppendBasicBlock( llvmFunction, "coro.done" );
+    buildSuspendSwitch( state, resumedWhenDone );
+    LLVMPositionBuilderAtEnd( builder, resumedWhenDone );
+    LLVMBuildUnreachable( builder );
+
+    // Free the frame, unless it was elided
+    LLVMPositionBuilderAtEnd( builder, coroutine.cleanupBlock );
+    LLVMValueRef frame = buildIntrinsic( "llvm.coro.free", {}, { coroutine.id, coroutine.handle } );
+    LLVMBasicBlockRef freeBlock = LLVMAppendBasicBlock( llvmFunction, "coro.free" );
+    LLVMBuildCondBr( builder, LLVMBuildIsNotNull( builder, frame, "" ), freeBlock, coroutine.suspendBlock );
+    LLVMPositionBuilderAtEnd( builder, freeBlock );
+    callFrameFunction(
+            module->getOptions().coroutines.deallocator,
+            LLVMFunctionType( LLVMVoidType(), &bytePointer, 1, false ), frame );
+    LLVMBuildBr( builder, coroutine.suspendBlock );
+
+    // Suspending returns the handle to whoever called or resumed the coroutine
+    LLVMPositionBuilderAtEnd( builder, coroutine.suspendBlock );
+    buildIntrinsic( "llvm.coro.end", {}, { coroutine.handle, LLVMConstInt( LLVMInt1Type(), 0, false ) } );
+    LLVMTypeRef returnType = LLVMGetReturnType( LLVMGlobalGetValueType(llvmFunction) );
+    LLVMBuildRet( builder, LLVMBuildPointerCast( builder, coroutine.handle, returnType, "" ) );
+
+    coroutine = CoroutineData();
+}
+
+static LLVMPassManagerRef createFunctionPasses( LLVMModuleRef module ) {
+    LLVMPassManagerRef passes = LLVMCreateFunctionPassManagerForModule(module);
+    LLVMAddPromoteMemoryToRegisterPass(passes);
+    LLVMAddEarlyCSEPass(passes);
+    LLVMAddInstructionCombiningPass(passes);
+    LLVMAddReassociatePass(passes);
+    LLVMAddGVNPass(passes);
+    LLVMAddCFGSimplificationPass(passes);
+    LLVMInitializeFunctionPassManager(passes);
+
+    return passes;
+}
+
+// Split coroutines into their ramp, resume and destroy functions. Required before code generation, whatever the
+// optimization level. Ramps are then inlined into their callers, so that frames whose lifetime is bounded by the
+// caller's can be elided into its frame
+static void lowerCoroutines( LLVMModuleRef module ) {
+    if( LLVMGetNamedFunction( module, "llvm.coro.id" )==nullptr )
+        return;
+
+    // The legacy pass manager's coroutine passes don't work outside of its standard pipelines
+    static const char pipeline[] =
+            "function(coro-early),cgscc(coro-split),always-inline,function(coro-elide),function(coro-cleanup)";
+    LLVMPassBuilderOptionsRef passOptions = LLVMCreatePassBuilderOptions();
+    LLVMErrorRef error = LLVMRunPasses( module, pipeline, nullptr, passOptions );
+    LLVMDisposePassBuilderOptions( passOptions );
+
+    if( error!=nullptr ) {
+        char *msg = LLVMGetErrorMessage( error );
+        std::cerr<<"Coroutine lowering failed: "<<msg<<"\n";
+        LLVMDisposeErrorMessage( msg );
+        abort();
+    }
+}
+
+// CPUID feature bits each x86-64 microarchitecture level adds to the previous one, from leaf 1 ECX, leaf 7 EBX and
+// leaf 0x80000001 ECX, and the register state (XCR0) the OS must save for it
+struct CpuLevelFeatures {
+    uint32_t leaf1Ecx, leaf7Ebx, extendedEcx, xcr0;
+};
+
+static const CpuLevelFeatures cpuLevelFeatures[] = {
+    // x86-64-v2: SSE3, SSSE3, CMPXCHG16B, SSE4.1, SSE4.2, POPCNT; LAHF
+    { 1u<<0 | 1u<<9 | 1u<<13 | 1u<<19 | 1u<<20 | 1u<<23, 0, 1u<<0, 0 },
+    // x86-64-v3: FMA, MOVBE, OSXSAVE, AVX, F16C; BMI1, AVX2, BMI2; LZCNT; SSE and AVX state
+    { 1u<<12 | 1u<<22 | 1u<<27 | 1u<<28 | 1u<<29, 1u<<3 | 1u<<5 | 1u<<8, 1u<<5, 0x6 },
+    // x86-64-v4: AVX512F, AVX512DQ, AVX512CD, AVX512BW, AVX512VL; opmask and ZMM state
+    { 0, 1u<<16 | 1u<<17 | 1u<<28 | 1u<<30 | 1u<<31, 0, 0xe0 },
+};
+
+// The module's function returning the x86-64 microarchitecture level of the CPU it runs on, 1 to 4. Resolvers run
+// before the program is relocated, so it calls nothing outside the module
+static LLVMValueRef cpuLevelFunction( LLVMModuleRef module ) {
+    static const char name[] = "practical.cpu_level";
+    LLVMValueRef function = LLVMGetNamedFunction( module, name );
+    if( function!=nullptr )
+        return function;
+
+    LLVMTypeRef int32 = LLVMInt32Type();
+    function = LLVMAddFunction( module, name, LLVMFunctionType( int32, nullptr, 0, false ) );
+    LLVMSetLinkage( function, LLVMInternalLinkage );
+
+    LLVMBasicBlockRef entryBlock = LLVMAppendBasicBlock( function, "entry" );
+    LLVMBasicBlockRef xgetbvBlock = LLVMAppendBasicBlock( function, "xgetbv" );
+    LLVMBasicBlockRef levelBlock = LLVMAppendBasicBlock( function, "level" );
+    LLVMBuilderRef builder = LLVMCreateBuilder();
+    LLVMPositionBuilderAtEnd( builder, entryBlock );
+
+    LLVMValueRef zero = LLVMConstInt( int32, 0, false );
+    LLVMTypeRef cpuidResults[] = { int32, int32, int32, int32 }, cpuidArguments[] = { int32, int32 };
+    LLVMTypeRef cpuidType = LLVMFunctionType( LLVMStructType( cpuidResults, 4, false ), cpuidArguments, 2, false );
+    static char cpuidCode[] = "cpuid", cpuidConstraints[] = "={ax},={bx},={cx},={dx},{ax},{cx}";
+    LLVMValueRef cpuidAsm = LLVMGetInlineAsm(
+            cpuidType, cpuidCode, strlen(cpuidCode), cpuidConstraints, strlen(cpuidConstraints), false, false,
+            LLVMInlineAsmDialectATT, false );
+
+    enum { Eax, Ebx, Ecx, Edx };
+    auto cpuid = [&]( uint32_t leaf, unsigned reg ) {
+        LLVMValueRef arguments[] = { LLVMConstInt( int32, leaf, false ), zero };
+        LLVMValueRef results = LLVMBuildCall2( builder, cpuidType, cpuidAsm, arguments, 2, "" );
+        return LLVMBuildExtractValue( builder, results, reg, "" );
+    };
+    // Leaves beyond the highest one the CPU has return unrelated data
+    auto cpuidIfSupported = [&]( uint32_t leaf, unsigned reg, LLVMValueRef maxLeaf ) {
+        LLVMValueRef supported = LLVMBuildICmp( builder, LLVMIntUGE, maxLeaf, LLVMConstInt( int32, leaf, false ), "" );
+        return LLVMBuildSelect( builder, supported, cpuid( leaf, reg ), zero, "" );
+    };
+    auto hasAll = [&]( LLVMValueRef value, uint32_t bits ) {
+        LLVMValueRef mask = LLVMConstInt( int32, bits, false );
+        return LLVMBuildICmp( builder, LLVMIntEQ, LLVMBuildAnd( builder, value, mask, "" ), mask, "" );
+    };
+
+    LLVMValueRef leaf1Ecx = cpuid( 1, Ecx );
+    LLVMValueRef leaf7Ebx = cpuidIfSupported( 7, Ebx, cpuid( 0, Eax ) );
+    LLVMValueRef extendedEcx = cpuidIfSupported( 0x80000001, Ecx, cpuid( 0x80000000, Eax ) );
+
+    // XGETBV faults unless the OS enabled it, as OSXSAVE says
+    LLVMBuildCondBr( builder, hasAll( leaf1Ecx, 1u<<27 ), xgetbvBlock, levelBlock );
+
+    LLVMPositionBuilderAtEnd( builder, xgetbvBlock );
+    LLVMTypeRef xgetbvResults[] = { int32, int32 };
+    LLVMTypeRef xgetbvType = LLVMFunctionType( LLVMStructType( xgetbvResults, 2, false ), &int32, 1, false );
+    static char xgetbvCode[] = "xgetbv", xgetbvConstraints[] = "={ax},={dx},{cx}";
+    LLVMValueRef xgetbvAsm = LLVMGetInlineAsm(
+            xgetbvType, xgetbvCode, strlen(xgetbvCode), xgetbvConstraints, strlen(xgetbvConstraints), true, false,
+            LLVMInlineAsmDialectATT, false );
+    LLVMValueRef savedState = LLVMBuildExtractValue(
+            builder, LLVMBuildCall2( builder, xgetbvType, xgetbvAsm, &zero, 1, "" ), 0, "" );
+    LLVMBuildBr( builder, levelBlock );
+
+    LLVMPositionBuilderAtEnd( builder, levelBlock );
+    LLVMValueRef xcr0 = LLVMBuildPhi( builder, int32, "xcr0" );
+    LLVMValueRef incomingValues[] = { zero, savedState };
+    LLVMBasicBlockRef incomingBlocks[] = { entryBlock, xgetbvBlock };
+    LLVMAddIncoming( xcr0, incomingValues, incomingBlocks, 2 );
+
+    // Each level requires all those below it
+    LLVMValueRef level = LLVMConstInt( int32, 1, false ), supported = nullptr;
+    auto require = [&]( LLVMValueRef value, uint32_t bits ) {
+        if( bits==0 )
+            return;
+
+        LLVMValueRef present = hasAll( value, bits );
+        supported = supported==nullptr ? present : LLVMBuildAnd( builder, supported, present, "" );
+    };
+    for( const CpuLevelFeatures &features : cpuLevelFeatures ) {
+        require( leaf1Ecx, features.leaf1Ecx );
+        require( leaf7Ebx, features.leaf7Ebx );
+        require( extendedEcx, features.extendedEcx );
+        require( xcr0, features.xcr0 );
+        level = LLVMBuildAdd( builder, level, LLVMBuildZExt( builder, supported, int32, "" ), "" );
+    }
+    LLVMBuildRet( builder, level );
+
+    LLVMDisposeBuilder( builder );
+
+    return function;
+}
+
+// An ifunc resolver returning the variant of the highest level the CPU supports. variants are by level, highest first
+static LLVMValueRef buildResolver(
+        LLVMModuleRef module, const std::string &name, const std::vector< std::pair<unsigned, LLVMValueRef> > &variants,
+        LLVMValueRef baseline )
+{
+    LLVMTypeRef variantType = LLVMTypeOf( baseline );
+    LLVMValueRef resolver = LLVMAddFunction(
+            module, ( name + ".resolver" ).c_str(), LLVMFunctionType( variantType, nullptr, 0, false ) );
+    LLVMSetLinkage( resolver, LLVMInternalLinkage );
+
+    LLVMBuilderRef builder = LLVMCreateBuilder();
+    LLVMPositionBuilderAtEnd( builder, LLVMAppendBasicBlock( resolver, "entry" ) );
+
+    LLVMValueRef levelFunction = cpuLevelFunction( module );
+    LLVMValueRef level = LLVMBuildCall2(
+            builder, LLVMGlobalGetValueType(levelFunction), levelFunction, nullptr, 0, "" );
+    LLVMValueRef chosen = baseline;
+    for( auto variant = variants.rbegin(); variant!=variants.rend(); ++variant ) {
+        LLVMValueRef supported = LLVMBuildICmp(
+                builder, LLVMIntUGE, level, LLVMConstInt( LLVMInt32Type(), variant->first, false ), "" );
+        chosen = LLVMBuildSelect( builder, supported, variant->second, chosen, "" );
+    }
+    LLVMBuildRet( builder, chosen );
+
+    LLVMDisposeBuilder( builder );
+
+    return resolver;
+}
+
+void ModuleGenImpl::buildTargetClones( LLVMModuleRef target ) {
+    size_t sourceFileNameLength;
+    const char *sourceFileName = LLVMGetSourceFileName( target, &sourceFileNameLength );
+    std::string reportName( sourceFileName, sourceFileNameLength );
+
+    for( const auto &clones : options.targetClones ) {
+        const std::string &name = clones.first;
+        LLVMValueRef function = LLVMGetNamedFunction( target, name.c_str() );
+        if( function==nullptr || LLVMIsDeclaration(function) )
+            continue;
+
+        static const char cpuAttribute[] = "target-cpu";
+        std::vector< std::pair<unsigned, LLVMValueRef> > variants;
+        std::vector< std::string > variantNames;
+        for( unsigned level : clones.second ) {
+            std::string cpu = "x86-64-v" + std::to_string(level);
+            variantNames.push_back( name + "." + cpu );
+
+            LLVMValueRef variant = cloneFunction( function, variantNames.back().c_str() );
+            LLVMSetLinkage( variant, LLVMInternalLinkage );
+            LLVMAddAttributeAtIndex(
+                    variant, LLVMAttributeFunctionIndex,
+                    LLVMCreateStringAttribute(
+                        LLVMGetGlobalContext(), cpuAttribute, strlen(cpuAttribute), cpu.c_str(), cpu.size() ) );
+            variants.emplace_back( level, variant );
+        }
+
+        variantNames.push_back( name + ".default" );
+        LLVMValueRef baseline = cloneFunction( function, variantNames.back().c_str() );
+        LLVMSetLinkage( baseline, LLVMInternalLinkage );
+
+        // The ifunc takes the function's place, including in the calls already made to it
+        LLVMValueRef ifunc = LLVMAddGlobalIFunc(
+                target, "", 0, LLVMGlobalGetValueType(function), 0, buildResolver( target, name, variants, baseline ) );
+        LLVMSetLinkage( ifunc, LLVMGetLinkage(function) );
+        LLVMReplaceAllUsesWith( function, ifunc );
+        LLVMDeleteFunction( function );
+        LLVMSetValueName2( ifunc, name.c_str(), name.size() );
+
+        // Calls to the function may run any of the variants
+        if( options.stackUsage.limit!=0 ) {
+            std::unordered_set<std::string> callees = std::move( callGraph[name] );
+            callGraph[name] = std::unordered_set<std::string>( variantNames.begin(), variantNames.end() );
+            for( const std::string &variantName : variantNames ) {
+                callGraph[variantName] = callees;
+            }
+        }
+
+        std::string msg = "Function " + name + " built for";
+        for( const std::string &variantName : variantNames ) {
+            msg += " " + variantName.substr( name.size()+1 );
+        }
+        msg += ", chosen at load time by CPUID";
+        emitMsg(MsgLevel::Info, reportName.c_str(), msg.c_str());
+    }
+}
+
 void ModuleGenImpl::moduleEnter(
         ModuleId id,
         String name,
@@ -470,12 +1919,37 @@ void ModuleGenImpl::moduleEnter(
     llvmModule = LLVMModuleCreateWithName(nullptr);
     LLVMSetModuleIdentifier(llvmModule, name.get(), name.size());
     LLVMSetSourceFileName(llvmModule, file.get(), file.size());
+    LLVMSetDataLayout(llvmModule, TargetDataLayout);
+
+    if( options.pipeline && options.functionPasses && streamingOutput==nullptr )
+        functionPasses = createFunctionPasses(llvmModule);
 }
 
 void ModuleGenImpl::moduleLeave(ModuleId id) {
-    char *error = NULL;
-    LLVMVerifyModule(llvmModule, LLVMAbortProcessAction, &error);
-    LLVMDisposeMessage(error);
+    if( functionPasses!=nullptr )
+        LLVMFinalizeFunctionPassManager(functionPasses);
+
+    finishDebugInfo( llvmModule );
+
+    if( options.verifyModule ) {
+        char *error = NULL;
+        LLVMVerifyModule(llvmModule, LLVMAbortProcessAction, &error);
+        LLVMDisposeMessage(error);
+    }
+
+    lowerCoroutines( llvmModule );
+
+    if( options.constEval.enabled && streamingOutput==nullptr )
+        evaluateConstantCalls( llvmModule, options.constEval );
+
+    buildTargetClones( llvmModule );
+}
+
+static bool isSignedInteger( StaticType::CPtr type ) {
+    auto typeType = type->getType();
+    auto scalar = std::get_if< const StaticType::Scalar * >( &typeType );
+    return scalar!=nullptr && ( type->getFlags() & StaticType::Flags::Reference )==0 &&
+            scalarType( (*scalar)->getTypeId() ).isSigned;
 }
 
 void ModuleGenImpl::declareIdentifier(String name, String mangledName, StaticType::CPtr type) {
@@ -483,13 +1957,33 @@ void ModuleGenImpl::declareIdentifier(String name, String mangledName, StaticTyp
     auto functionType = std::get_if< const StaticType::Function * >( &typeType );
 
     if( functionType!=nullptr ) {
-        LLVMAddFunction( llvmModule, toStdString(mangledName).c_str(), toLLVMType( type ) );
+        const StaticType::Function *function = *functionType;
+        std::vector<bool> references, signedValues;
+        references.reserve( function->getNumArguments() + 1 );
+        signedValues.reserve( function->getNumArguments() + 1 );
+        references.push_back( function->getReturnType()->getFlags() & StaticType::Flags::Reference );
+        signedValues.push_back( isSignedInteger( function->getReturnType() ) );
+        for( unsigned i=0; i<function->getNumArguments(); ++i ) {
+            references.push_back( function->getArgumentType(i)->getFlags() & StaticType::Flags::Reference );
+            signedValues.push_back( isSignedInteger( function->getArgumentType(i) ) );
+        }
+
+        declareFunction( mangledName, toLLVMType( type ), references, signedValues );
     } else {
-        std::cerr<<"TODO implement declare "<<name<<" "<<type<<"\n";
-        abort();
+        declareGlobal( mangledName, toLLVMType( type ) );
     }
 }
 
+// Practical globals are zero initialized, and every module that sees one's declaration defines it, so variables have
+// common linkage (like C's tentative definitions) and are merged by the linker
+void ModuleGenImpl::declareGlobal( String mangledName, LLVMTypeRef type ) {
+    std::string name = sliceToString(mangledName);
+    LLVMValueRef global = LLVMAddGlobal( llvmModule, type, name.c_str() );
+    LLVMSetInitializer( global, LLVMConstNull(type) );
+    LLVMSetAlignment( global, typeAlignment(type) );
+    LLVMSetLinkage( global, LLVMCommonLinkage );
+}
+
 void ModuleGenImpl::declareStruct(PracticalSemanticAnalyzer::StaticType::CPtr type) {
     auto strct = std::get<const StaticType::Struct *>( type->getType() );
     std::string name = sliceToString( strct->getName() );
@@ -497,20 +1991,243 @@ void ModuleGenImpl::declareStruct(PracticalSemanticAnalyzer::StaticType::CPtr ty
     registerTypeMap( type, llvmStruct );
 }
 
+void ModuleGenImpl::declareFunction(
+        String mangledName, LLVMTypeRef functionType, const std::vector<bool> &references,
+        const std::vector<bool> &signedValues )
+{
+    assert( references.size()==LLVMCountParamTypes(functionType) + 1 );
+    assert( signedValues.size()==references.size() );
+
+    std::string name = toStdString(mangledName);
+    setParameterAttributes( LLVMAddFunction( llvmModule, name.c_str(), functionType ), references );
+
+    if( isBuiltin( name.c_str() ) )
+        builtinSignedness[name] = signedValues;
+}
+
+const std::vector<bool> &ModuleGenImpl::getBuiltinSignedness( const char *name ) const {
+    auto signedness = builtinSignedness.find( name );
+    assert( signedness!=builtinSignedness.end() );
+
+    return signedness->second;
+}
+
+static void addEnumAttribute( LLVMValueRef function, LLVMAttributeIndex index, const char *name, uint64_t value = 0 ) {
+    unsigned kind = LLVMGetEnumAttributeKindForName( name, strlen(name) );
+    assert( kind!=0 );
+    LLVMAddAttributeAtIndex( function, index, LLVMCreateEnumAttribute( LLVMGetGlobalContext(), kind, value ) );
+}
+
+// Tell LLVM what the type system guarantees about values crossing function boundaries: Practical values are never
+// undefined, Bool is 0 or 1, and references are never null and point at a whole, aligned object
+void ModuleGenImpl::setParameterAttributes( LLVMValueRef function, const std::vector<bool> &references ) {
+    LLVMTargetDataRef dataLayout = LLVMGetModuleDataLayout(llvmModule);
+    LLVMTypeRef functionType = LLVMGlobalGetValueType(function);
+    unsigned numParams = LLVMCountParamTypes(functionType);
+    std::vector<LLVMTypeRef> paramTypes( numParams );
+    LLVMGetParamTypes( functionType, paramTypes.data() );
+
+    for( unsigned index=0; index<=numParams; ++index ) {
+        LLVMTypeRef type = index==0 ? LLVMGetReturnType(functionType) : paramTypes[index-1];
+        LLVMAttributeIndex attributeIndex = index==0 ? static_cast<unsigned>( LLVMAttributeReturnIndex ) : index;
+
+        switch( LLVMGetTypeKind(type) ) {
+        case LLVMIntegerTypeKind:
+            addEnumAttribute( function, attributeIndex, "noundef" );
+            if( LLVMGetIntTypeWidth(type)==1 )
+                addEnumAttribute( function, attributeIndex, "zeroext" );
+            break;
+        case LLVMPointerTypeKind:
+            addEnumAttribute( function, attributeIndex, "noundef" );
+
+            if( references[index] ) {
+                addEnumAttribute( function, attributeIndex, "nonnull" );
+
+                LLVMTypeRef pointedType = LLVMGetElementType(type);
+                if( LLVMTypeIsSized(pointedType) ) {
+                    unsigned long long size = LLVMABISizeOfType( dataLayout, pointedType );
+                    if( size!=0 )
+                        addEnumAttribute( function, attributeIndex, "dereferenceable", size );
+                    addEnumAttribute( function, attributeIndex, "align", typeAlignment(pointedType) );
+                }
+            }
+
+            if( index!=0 && options.noAliasArguments )
+                addEnumAttribute( function, attributeIndex, "noalias" );
+            break;
+        default:
+            break;
+        }
+    }
+}
+
 void ModuleGenImpl::defineStruct(StaticType::CPtr strctType) {
     auto strct = std::get<const StaticType::Struct *>( strctType->getType() );
 
-    LLVMTypeRef llvmStruct = toLLVMType( strctType );
-
     const size_t numMembers = strct->getNumMembers();
-
-    LLVMTypeRef structMembers[ numMembers ];
+    std::vector<LoweredMember> structMembers;
+    structMembers.reserve( numMembers );
 
     for( unsigned i=0; i<numMembers; ++i ) {
-        structMembers[i] = toLLVMType( strct->getMember(i).type );
+        const auto &member = strct->getMember(i);
+        structMembers.emplace_back( LoweredMember{ .name = member.name, .type = toLLVMType( member.type ) } );
+    }
+
+    defineStruct( toLLVMType( strctType ), structMembers );
+}
+
+static unsigned long long alignTo( unsigned long long offset, unsigned alignment ) {
+    return ( offset + alignment - 1 ) & ~( static_cast<unsigned long long>(alignment) - 1 );
+}
+
+// Members are placed in declaration order unless reordering was asked for, in which case they are sorted by decreasing
+// alignment, which leaves no padding between members whose sizes are multiples of their alignment. LLVM has no notion
+// of alignment beyond a type's natural one, so requested alignments are implemented with explicit padding members.
+void ModuleGenImpl::defineStruct( LLVMTypeRef llvmStruct, const std::vector<LoweredMember> &members ) {
+    const StructLayoutOptions &layoutOptions = options.structLayout;
+    LLVMTargetDataRef dataLayout = LLVMGetModuleDataLayout(llvmModule);
+    std::string structName = LLVMGetStructName(llvmStruct);
+    bool packed = layoutOptions.packed.count( structName )!=0;
+
+    std::vector<unsigned> alignments;
+    alignments.reserve( members.size() );
+    for( const LoweredMember &member : members ) {
+        unsigned alignment = packed ? 1 : typeAlignment( member.type );
+
+        auto requested = layoutOptions.memberAlignment.find( structName + "." + sliceToString( member.name ) );
+        if( requested!=layoutOptions.memberAlignment.end() )
+            alignment = std::max( alignment, requested->second );
+
+        alignments.push_back( alignment );
+    }
+
+    std::vector<unsigned> order( members.size() );
+    std::iota( order.begin(), order.end(), 0 );
+    if( layoutOptions.reorder && !packed ) {
+        std::stable_sort( order.begin(), order.end(), [&]( unsigned left, unsigned right ) {
+                    return alignments[left] > alignments[right];
+                } );
+    }
+
+    auto padding = []( unsigned long long size ) {
+        return LLVMArrayType( LLVMInt8Type(), size );
+    };
+
+    StructLayout layout;
+    layout.elementIndexes.resize( members.size() );
+    std::vector<LLVMTypeRef> elements;
+    unsigned long long offset = 0;
+    unsigned structAlignment = 1, naturalStructAlignment = 1;
+
+    for( unsigned member : order ) {
+        LLVMTypeRef type = members[member].type;
+        unsigned naturalAlignment = packed ? 1 : LLVMABIAlignmentOfType( dataLayout, type );
+        unsigned long long memberOffset = alignTo( offset, alignments[member] );
+
+        if( memberOffset!=alignTo( offset, naturalAlignment ) )
+            elements.push_back( padding( memberOffset - offset ) );
+
+        layout.elementIndexes[member] = elements.size();
+        elements.push_back( type );
+
+        offset = memberOffset + LLVMABISizeOfType( dataLayout, type );
+        structAlignment = std::max( structAlignment, alignments[member] );
+        naturalStructAlignment = std::max( naturalStructAlignment, naturalAlignment );
+    }
+
+    auto requested = layoutOptions.structAlignment.find( structName );
+    if( requested!=layoutOptions.structAlignment.end() )
+        structAlignment = std::max( structAlignment, requested->second );
+
+    if( structAlignment>naturalStructAlignment ) {
+        // Pad the size to a multiple of the alignment, so array elements stay aligned
+        unsigned long long size = alignTo( offset, structAlignment );
+        if( size!=alignTo( offset, naturalStructAlignment ) )
+            elements.push_back( padding( size - offset ) );
+
+        layout.alignment = structAlignment;
+    }
+
+    LLVMStructSetBody(llvmStruct, elements.data(), elements.size(), packed);
+    tbaaTypeNode( llvmStruct );
+
+    if( layoutOptions.report )
+        reportStructLayout( llvmStruct, members, layout );
+
+    structLayouts.emplace( llvmStruct, std::move(layout) );
+}
+
+unsigned ModuleGenImpl::typeAlignment( LLVMTypeRef type ) const {
+    unsigned alignment = LLVMABIAlignmentOfType( LLVMGetModuleDataLayout(llvmModule), type );
+
+    switch( LLVMGetTypeKind(type) ) {
+    case LLVMArrayTypeKind:
+        alignment = std::max( alignment, typeAlignment( LLVMGetElementType(type) ) );
+        break;
+    case LLVMStructTypeKind:
+        {
+            auto layout = structLayouts.find( type );
+            if( layout!=structLayouts.end() )
+                alignment = std::max( alignment, layout->second.alignment );
+        }
+        break;
+    default:
+        break;
+    }
+
+    return alignment;
+}
+
+static constexpr unsigned long long CacheLineSize = 64;
+
+void ModuleGenImpl::reportStructLayout(
+        LLVMTypeRef llvmStruct, const std::vector<LoweredMember> &members, const StructLayout &layout ) const
+{
+    LLVMTargetDataRef dataLayout = LLVMGetModuleDataLayout(llvmModule);
+    unsigned numElements = LLVMCountStructElementTypes(llvmStruct);
+    unsigned long long size = LLVMABISizeOfType( dataLayout, llvmStruct );
+
+    std::vector< const LoweredMember * > elementMembers( numElements, nullptr );
+    for( unsigned i=0; i<members.size(); ++i ) {
+        elementMembers[ layout.elementIndexes[i] ] = &members[i];
+    }
+
+    std::ostringstream rows;
+    unsigned long long totalPadding = 0, nextBoundary = CacheLineSize;
+    auto row = [&]( unsigned long long offset, unsigned long long rowSize, const LoweredMember *member ) {
+        for( ; nextBoundary<=offset; nextBoundary+=CacheLineSize ) {
+            rows<<"    -------- cache line boundary at "<<nextBoundary<<"\n";
+        }
+
+        rows<<"    "<<std::setw(8)<<offset<<std::setw(8)<<rowSize<<"  ";
+        if( member!=nullptr ) {
+            rows<<member->name;
+        } else {
+            rows<<"(padding)";
+            totalPadding += rowSize;
+        }
+        if( offset+rowSize>nextBoundary )
+            rows<<"  (crosses a cache line boundary)";
+        rows<<"\n";
+    };
+
+    unsigned long long end = 0;
+    for( unsigned i=0; i<numElements; ++i ) {
+        unsigned long long offset = LLVMOffsetOfElement( dataLayout, llvmStruct, i );
+        if( offset>end )
+            row( end, offset-end, nullptr );
+
+        unsigned long long elementSize = LLVMABISizeOfType( dataLayout, LLVMStructGetTypeAtIndex( llvmStruct, i ) );
+        row( offset, elementSize, elementMembers[i] );
+        end = offset + elementSize;
     }
+    if( size>end )
+        row( end, size-end, nullptr );
 
-    LLVMStructSetBody(llvmStruct, structMembers, numMembers, false);
+    unsigned alignment = std::max( layout.alignment, LLVMABIAlignmentOfType( dataLayout, llvmStruct ) );
+    std::cout<<"struct "<<LLVMGetStructName(llvmStruct)<<": size "<<size<<", alignment "<<alignment<<", padding "<<
+            totalPadding<<", cache lines "<<( size + CacheLineSize - 1 ) / CacheLineSize<<"\n"<<
+            "      offset    size  member\n"<<rows.str();
 }
 
 std::shared_ptr<FunctionGen> ModuleGenImpl::handleFunction()
@@ -518,6 +2235,212 @@ std::shared_ptr<FunctionGen> ModuleGenImpl::handleFunction()
     return std::shared_ptr<FunctionGen>( new FunctionGenImpl(this) );
 }
 
+LLVMModuleRef ModuleGenImpl::functionModule( String name ) {
+    if( streamingOutput==nullptr )
+        return llvmModule;
+
+    LLVMModuleRef functionModule = LLVMModuleCreateWithName( toStdString(name).c_str() );
+    size_t sourceFileNameLength;
+    const char *sourceFileName = LLVMGetSourceFileName( llvmModule, &sourceFileNameLength );
+    LLVMSetSourceFileName( functionModule, sourceFileName, sourceFileNameLength );
+    LLVMSetDataLayout( functionModule, TargetDataLayout );
+
+    return functionModule;
+}
+
+static void copyAttributes( LLVMValueRef destination, LLVMValueRef source, LLVMAttributeIndex index ) {
+    std::vector<LLVMAttributeRef> attributes( LLVMGetAttributeCountAtIndex( source, index ) );
+    LLVMGetAttributesAtIndex( source, index, attributes.data() );
+    for( LLVMAttributeRef attribute : attributes ) {
+        LLVMAddAttributeAtIndex( destination, index, attribute );
+    }
+}
+
+LLVMValueRef ModuleGenImpl::lookupFunction( LLVMModuleRef target, const char *name ) {
+    LLVMValueRef function = LLVMGetNamedFunction( target, name );
+
+    if( function==nullptr && target!=llvmModule ) {
+        LLVMValueRef declaration = LLVMGetNamedFunction( llvmModule, name );
+        assert( declaration!=nullptr );
+        function = LLVMAddFunction( target, name, LLVMGlobalGetValueType( declaration ) );
+
+        copyAttributes( function, declaration, LLVMAttributeFunctionIndex );
+        for( unsigned index=LLVMAttributeReturnIndex; index<=LLVMCountParams(function); ++index ) {
+            copyAttributes( function, declaration, index );
+        }
+    }
+
+    return function;
+}
+
+void ModuleGenImpl::noteCall( const std::string &caller, const char *callee ) {
+    if( options.stackUsage.limit==0 )
+        return;
+
+    auto &callees = callGraph[caller];
+    if( callee!=nullptr )
+        callees.emplace( callee );
+}
+
+void ModuleGenImpl::functionDone( LLVMValueRef function ) {
+    if( streamingOutput!=nullptr ) {
+        // Optimize and emit the function right away, then release its module
+        LLVMModuleRef functionModule = LLVMGetGlobalParent( function );
+        finishDebugInfo( functionModule );
+
+        if( options.verifyModule ) {
+            char *error = NULL;
+            LLVMVerifyModule(functionModule, LLVMAbortProcessAction, &error);
+            LLVMDisposeMessage(error);
+        }
+
+        if( options.functionPasses ) {
+            LLVMPassManagerRef passes = createFunctionPasses( functionModule );
+            LLVMRunFunctionPassManager(passes, function);
+            LLVMFinalizeFunctionPassManager(passes);
+            LLVMDisposePassManager(passes);
+        }
+        lowerCoroutines( functionModule );
+        buildTargetClones( functionModule );
+
+        streamingOutput->emitFunction( functionModule );
+    } else if( functionPasses!=nullptr ) {
+        LLVMRunFunctionPassManager(functionPasses, function);
+    }
+}
+
+LLVMMetadataRef ModuleGenImpl::functionScope(
+        LLVMModuleRef target, LLVMValueRef function, String file, const SourceLocation &location )
+{
+    if( !options.remarks.enabled() )
+        return nullptr;
+
+    DebugInfo &info = debugInfo[target];
+    if( info.builder==nullptr ) {
+        info.builder = LLVMCreateDIBuilderDisallowUnresolved( target );
+
+        // DWARF has no language code for Practical. NoDebug emission keeps the locations in the IR for the remarks, but
+        // puts no debug information in the object
+        LLVMMetadataRef unitFile = LLVMDIBuilderCreateFile( info.builder, file.get(), file.size(), "", 0 );
+        info.compileUnit = LLVMDIBuilderCreateCompileUnit(
+                info.builder, LLVMDWARFSourceLanguageC, unitFile, "practicomp", strlen("practicomp"), false, "", 0, 0,
+                "", 0, LLVMDWARFEmissionNone, 0, false, false, "", 0, "", 0 );
+
+        LLVMAddModuleFlag(
+                target, LLVMModuleFlagBehaviorWarning, "Debug Info Version", strlen("Debug Info Version"),
+                LLVMValueAsMetadata( LLVMConstInt( LLVMInt32Type(), LLVMDebugMetadataVersion(), false ) ) );
+    }
+
+    size_t nameLength;
+    const char *name = LLVMGetValueName2( function, &nameLength );
+    LLVMMetadataRef fileNode = LLVMDIBuilderCreateFile( info.builder, file.get(), file.size(), "", 0 );
+    LLVMMetadataRef type = LLVMDIBuilderCreateSubroutineType( info.builder, fileNode, nullptr, 0, LLVMDIFlagZero );
+    LLVMMetadataRef subprogram = LLVMDIBuilderCreateFunction(
+            info.builder, fileNode, name, nameLength, name, nameLength, fileNode, location.line, type, false, true,
+            location.line, LLVMDIFlagZero, false );
+    LLVMSetSubprogram( function, subprogram );
+
+    return subprogram;
+}
+
+void ModuleGenImpl::finishDebugInfo( LLVMModuleRef target ) {
+    auto info = debugInfo.find( target );
+    if( info==debugInfo.end() )
+        return;
+
+    LLVMDIBuilderFinalize( info->second.builder );
+    LLVMDisposeDIBuilder( info->second.builder );
+    debugInfo.erase( info );
+}
+
+// Practical has no pointer casts and no type that may alias any other (like C's char), so accesses to different types
+// never alias. Types are distinguished by their LLVM lowering: signed and unsigned integers of the same width share a
+// node, which is conservative. Pointers get a node per pointed-to type, and arrays share the node of their elements.
+LLVMMetadataRef ModuleGenImpl::tbaaTypeNode( LLVMTypeRef type ) {
+    auto cached = tbaaTypes.find( type );
+    if( cached!=tbaaTypes.end() )
+        return cached->second;
+
+    LLVMContextRef ctx = LLVMGetGlobalContext();
+    LLVMTypeRef offsetType = LLVMInt64Type();
+
+    if( tbaaRoot==nullptr ) {
+        LLVMMetadataRef name = LLVMMDStringInContext2( ctx, "Practical TBAA", strlen("Practical TBAA") );
+        tbaaRoot = LLVMMDNodeInContext2( ctx, &name, 1 );
+    }
+
+    LLVMMetadataRef node = nullptr;
+    switch( LLVMGetTypeKind(type) ) {
+    case LLVMArrayTypeKind:
+        node = tbaaTypeNode( LLVMGetElementType(type) );
+        break;
+    case LLVMStructTypeKind:
+        {
+            // An empty struct's node would look like a root
+            if( LLVMIsOpaqueStruct(type) || LLVMCountStructElementTypes(type)==0 )
+                return nullptr;
+
+            LLVMTargetDataRef dataLayout = LLVMGetModuleDataLayout(llvmModule);
+            char *name = LLVMPrintTypeToString(type);
+            std::vector<LLVMMetadataRef> operands{ LLVMMDStringInContext2( ctx, name, strlen(name) ) };
+            LLVMDisposeMessage(name);
+
+            for( unsigned i=0; i<LLVMCountStructElementTypes(type); ++i ) {
+                LLVMMetadataRef member = tbaaTypeNode( LLVMStructGetTypeAtIndex(type, i) );
+                if( member==nullptr )
+                    return nullptr;
+
+                operands.push_back( member );
+                operands.push_back( LLVMValueAsMetadata(
+                            LLVMConstInt( offsetType, LLVMOffsetOfElement(dataLayout, type, i), false ) ) );
+            }
+
+            node = LLVMMDNodeInContext2( ctx, operands.data(), operands.size() );
+        }
+        break;
+    case LLVMIntegerTypeKind:
+    case LLVMPointerTypeKind:
+        {
+            char *name = LLVMPrintTypeToString(type);
+            LLVMMetadataRef operands[3] = {
+                LLVMMDStringInContext2( ctx, name, strlen(name) ),
+                tbaaRoot,
+                LLVMValueAsMetadata( LLVMConstInt( offsetType, 0, false ) )
+            };
+            LLVMDisposeMessage(name);
+
+            node = LLVMMDNodeInContext2( ctx, operands, 3 );
+        }
+        break;
+    default:
+        return nullptr;
+    }
+
+    tbaaTypes.emplace( type, node );
+
+    return node;
+}
+
+LLVMMetadataRef ModuleGenImpl::tbaaAccessTag(
+        LLVMTypeRef accessType, LLVMTypeRef containerType, unsigned long long offset )
+{
+    if( isAggregate(accessType) )
+        return nullptr;
+
+    LLVMMetadataRef accessNode = tbaaTypeNode( accessType );
+    LLVMMetadataRef baseNode = containerType!=nullptr ? tbaaTypeNode( containerType ) : accessNode;
+    if( accessNode==nullptr || baseNode==nullptr )
+        return nullptr;
+
+    LLVMMetadataRef operands[3] = {
+        baseNode,
+        accessNode,
+        LLVMValueAsMetadata( LLVMConstInt( LLVMInt64Type(), containerType!=nullptr ? offset : 0, false ) )
+    };
+
+    return LLVMMDNodeInContext2( LLVMGetGlobalContext(), operands, 3 );
+}
+
 void ModuleGenImpl::dump() {
     assert(llvmModule != nullptr);
     LLVMDumpModule(llvmModule);
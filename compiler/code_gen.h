@@ -10,16 +10,21 @@
 #define CODE_GEN_H
 
 #include <nocopy.h>
+#include <options.h>
 #include <practical/practical.h>
+#include <stack_usage.h>
 
 #include <llvm-c/Core.h>
+#include <llvm-c/DebugInfo.h>
 
 #include <deque>
 #include <unordered_map>
+#include <vector>
 
 using namespace PracticalSemanticAnalyzer;
 
 class ModuleGenImpl;
+class StreamingOutput;
 
 class JumpPointData : NoCopy {
 public:
@@ -30,6 +35,10 @@ private:
     bool defined = false;
 
 public:
+    LLVMBasicBlockRef block = nullptr;
+    // If this point is a loop header, all back edges go through this block so the loop has a single latch
+    LLVMBasicBlockRef latch = nullptr;
+
     explicit JumpPointData( Type type );
     explicit JumpPointData( const std::string &label ) : type(Type::Label), label( std::move(label) ) {}
 
@@ -38,6 +47,10 @@ public:
         defined = true;
     }
 
+    bool isDefined() const {
+        return defined;
+    }
+
     const std::string &getLabel() const {
         return label;
     }
@@ -45,21 +58,57 @@ public:
 
 struct BranchPointData {
     JumpPointId elsePointId, continuationPointId;
-    LLVMBasicBlockRef elsePointBlock = nullptr, continuationPointBlock = nullptr;
+    LLVMValueRef branchInstruction = nullptr;
+    LLVMBasicBlockRef ifBlock = nullptr, elsePointBlock = nullptr, continuationPointBlock = nullptr;
     LLVMBasicBlockRef phiBlocks[2];
     ExpressionId conditionValue, ifBlockValue, elseBlockValue;
-    StaticType::CPtr type;
+    LLVMTypeRef type = nullptr;
+};
+
+struct LoopData {
+    LLVMBasicBlockRef header, latch;
+};
+
+// A call immediately followed by a return of its result
+struct TailCallData {
+    LLVMValueRef call, ret;
+};
+
+// A coroutine's id and handle, and the blocks it suspends through, is destroyed through and finishes through
+struct CoroutineData {
+    LLVMValueRef id = nullptr, handle = nullptr;
+    LLVMBasicBlockRef suspendBlock = nullptr, cleanupBlock = nullptr, finalBlock = nullptr;
 };
 
 class FunctionGenImpl : public FunctionGen, private NoCopy {
     ModuleGenImpl *module = nullptr;
+    // The LLVM module the function is generated into. When streaming, each function has a module of its own
+    LLVMModuleRef llvmModule = nullptr;
     LLVMValueRef llvmFunction = nullptr;
     LLVMBasicBlockRef currentBlock = nullptr, nextBlock = nullptr;
+    // Block opened after a terminator to hold any (unreachable) code that follows it
+    LLVMBasicBlockRef deadBlock = nullptr;
+    // The entry block's terminator. Stack allocations are placed before it
+    LLVMValueRef entryBranch = nullptr;
+    // Where self recursive tail calls jump to, and the latch all such jumps go through
+    LLVMBasicBlockRef bodyBlock = nullptr, tailRecursionLatch = nullptr;
+    std::string functionName, fileName;
     LLVMBuilderRef builder = nullptr;
 
     std::unordered_map< ExpressionId, LLVMValueRef > expressionValuesTable;
+    // The pure instructions expressions were given so far, by a hash of their opcode, block and operands
+    std::unordered_multimap< size_t, LLVMValueRef > valueNumbers;
     std::unordered_map< JumpPointId, JumpPointData > jumpPointsTable;
     std::deque< BranchPointData > branchStack;
+    std::vector< LoopData > loops;
+    std::vector< LLVMValueRef > argumentSlots;
+    std::vector< TailCallData > tailCalls;
+    // Loads of whole aggregates. Those left unused after aggregate copies were lowered are removed at function end
+    std::vector< LLVMValueRef > aggregateLoads;
+    // Set when the function is a coroutine
+    CoroutineData coroutine;
+    // The function's descriptor for the timing runtime, when built with timing probes
+    LLVMValueRef timingFunction = nullptr;
 
 public:
     FunctionGenImpl(ModuleGenImpl *module) : module(module) {}
@@ -140,19 +189,110 @@ public:
 
 
     virtual void operatorLogicalNot( ExpressionId id, ExpressionId argument ) override;
+
+    // Variants of the callbacks above that take types already lowered to LLVM. The overrides resolve their types and
+    // forward here, and the trace replayer, which has no semantic analyzer types, calls these directly. The other
+    // callbacks must not look at their types, as the replayer passes them null ones.
+    struct LoweredArgument {
+        String name;
+        LLVMTypeRef type;
+        ExpressionId lvalueId;
+    };
+
+    void functionEnter(
+            String name, const std::vector<LoweredArgument> &arguments, String file, const SourceLocation &location );
+    void conditionalBranch(
+            ExpressionId id, LLVMTypeRef type, ExpressionId conditionExpression, JumpPointId elsePoint,
+            JumpPointId continuationPoint );
+    void setLiteral( ExpressionId id, LongEnoughInt value, LLVMTypeRef type );
+    void setLiteralNull( ExpressionId id, LLVMTypeRef type );
+    void allocateStackVar( ExpressionId id, LLVMTypeRef type, String name );
+    void truncateInteger( ExpressionId id, ExpressionId source, LLVMTypeRef destType );
+    void expandIntegerSigned( ExpressionId id, ExpressionId source, LLVMTypeRef destType );
+    void expandIntegerUnsigned( ExpressionId id, ExpressionId source, LLVMTypeRef destType );
 private:
     LLVMValueRef lookupExpression( ExpressionId id ) const;
     void addExpression( ExpressionId id, LLVMValueRef value );
+    LLVMValueRef numberValue( LLVMValueRef value );
 
     LLVMBasicBlockRef addBlock( const std::string &label = "" );
     void setCurrentBlock( LLVMBasicBlockRef newCurrentBlock );
+    LLVMValueRef buildAlloca( LLVMTypeRef type, String name );
+
+    JumpPointData &lookupJumpPoint( JumpPointId id, JumpPointData::Type type, const std::string &label = "" );
+    LLVMBasicBlockRef jumpPointBlock( JumpPointData &point );
+    void closeBlock( LLVMBasicBlockRef continuation );
+    void startDeadBlock();
+    bool foldToSelect( BranchPointData &branch );
+    void finalizeLoops();
+    void noteTailCall( LLVMValueRef ret );
+    bool stackAddressEscapes() const;
+    void lowerTailCalls();
+    void setAccessType( LLVMValueRef instruction, LLVMTypeRef containerType = nullptr, unsigned long long offset = 0 );
+    bool loadedValueUnchanged( LLVMValueRef load ) const;
+    void storeAggregate( LLVMValueRef address, LLVMValueRef value );
+    void copyMemory(
+            LLVMValueRef destination, LLVMValueRef source, LLVMTypeRef type, unsigned alignment,
+            LLVMTypeRef containerType = nullptr, unsigned long long offset = 0 );
+    void storeZero( LLVMValueRef address, LLVMTypeRef type, unsigned alignment );
+    bool storeWide( LLVMValueRef destination, LLVMValueRef source, LLVMTypeRef type, unsigned alignment );
+    void eraseDeadAggregateLoads();
+    void coalesceStores();
+    LLVMValueRef buildIntrinsic(
+            const char *name, const std::vector<LLVMTypeRef> &overloads, const std::vector<LLVMValueRef> &arguments );
+    LLVMValueRef callFrameFunction( const std::string &name, LLVMTypeRef type, LLVMValueRef argument );
+    void beginCoroutine();
+    void suspendCoroutine( ExpressionId id, LLVMTypeRef returnType );
+    void buildSuspendSwitch( LLVMValueRef state, LLVMBasicBlockRef resumeBlock );
+    void finishCoroutine();
+    void buildTimingProbe( const char *probeName );
 };
 
 class ModuleGenImpl : public ModuleGen, private NoCopy {
     LLVMModuleRef llvmModule = nullptr;
+    // Optimizes each function once it is complete. Only used when pipelining
+    LLVMPassManagerRef functionPasses = nullptr;
+    StreamingOutput *streamingOutput = nullptr;
+    const CompilerOptions &options;
+
+    struct StructLayout {
+        // The LLVM element index of each member, in declaration order. Elements not listed are padding
+        std::vector<unsigned> elementIndexes;
+        // Alignment beyond what the LLVM type implies, or 0 if there is none
+        unsigned alignment = 0;
+    };
+    std::unordered_map< LLVMTypeRef, StructLayout > structLayouts;
+
+    // Type based alias analysis nodes, by the LLVM type they describe
+    LLVMMetadataRef tbaaRoot = nullptr;
+    std::unordered_map< LLVMTypeRef, LLVMMetadataRef > tbaaTypes;
+
+    // Only recorded when checking the stack bound
+    CallGraph callGraph;
+
+    // Builtins, by name: whether the return value (first) and each of the parameters is a signed integer. Narrower
+    // operands are extended to the width the builtin works at accordingly
+    std::unordered_map< std::string, std::vector<bool> > builtinSignedness;
+
+    // Debug information is only generated to locate optimization remarks, and isn't emitted. By LLVM module, as
+    // streamed functions each have a module of their own
+    struct DebugInfo {
+        LLVMDIBuilderRef builder = nullptr;
+        LLVMMetadataRef compileUnit = nullptr;
+    };
+    std::unordered_map< LLVMModuleRef, DebugInfo > debugInfo;
+
+    void setParameterAttributes( LLVMValueRef function, const std::vector<bool> &references );
 public:
 
+    explicit ModuleGenImpl( const CompilerOptions &options ) : options( options ) {}
+
     virtual ~ModuleGenImpl() {
+        for( auto &info : debugInfo ) {
+            LLVMDisposeDIBuilder( info.second.builder );
+        }
+        if( functionPasses!=nullptr )
+            LLVMDisposePassManager(functionPasses);
         LLVMDisposeModule(llvmModule);
     }
 
@@ -160,6 +300,19 @@ public:
         return llvmModule;
     }
 
+    const CompilerOptions &getOptions() const {
+        return options;
+    }
+
+    // When set, each function is generated into a module of its own, and emitted as soon as it is complete
+    void setStreamingOutput( StreamingOutput *output ) {
+        streamingOutput = output;
+    }
+
+    StreamingOutput *getStreamingOutput() const {
+        return streamingOutput;
+    }
+
     virtual void moduleEnter(
             ModuleId id,
             String name,
@@ -173,9 +326,58 @@ public:
     virtual void declareStruct(StaticType::CPtr structType) override;
     virtual void defineStruct(StaticType::CPtr strct) override;
 
+    // Lowered variants of the above, see FunctionGenImpl
+    struct LoweredMember {
+        String name;
+        LLVMTypeRef type;
+    };
+
+    // references and signedValues say which of the return value (first) and the parameters are references, and which
+    // are signed integers
+    void declareFunction(
+            String mangledName, LLVMTypeRef functionType, const std::vector<bool> &references,
+            const std::vector<bool> &signedValues );
+    void declareGlobal( String mangledName, LLVMTypeRef type );
+    void defineStruct( LLVMTypeRef llvmStruct, const std::vector<LoweredMember> &members );
+
+    // The alignment objects of the type need, including any requested with alignment options
+    unsigned typeAlignment( LLVMTypeRef type ) const;
+
     virtual std::shared_ptr<FunctionGen> handleFunction() override;
 
+    // The LLVM module to generate the named function into
+    LLVMModuleRef functionModule( String name );
+    // Looks up a declared function in a module returned by functionModule, declaring it there if needed
+    LLVMValueRef lookupFunction( LLVMModuleRef target, const char *name );
+    // Which of a builtin's return value (first) and parameters are signed integers
+    const std::vector<bool> &getBuiltinSignedness( const char *name ) const;
+    // Called by FunctionGenImpl once the function's IR is complete
+    void functionDone( LLVMValueRef function );
+    // The debug scope of a function in a module returned by functionModule. Null unless optimization remarks are on
+    LLVMMetadataRef functionScope(
+            LLVMModuleRef target, LLVMValueRef function, String file, const SourceLocation &location );
+    // Finalize the debug information of a module returned by functionModule, before it is verified
+    void finishDebugInfo( LLVMModuleRef target );
+
+    // The TBAA type node of a scalar or struct type, or null if the type has none
+    LLVMMetadataRef tbaaTypeNode( LLVMTypeRef type );
+    // TBAA tag for accessing a value of accessType. If containerType is set, the value is the member at the given
+    // offset of a struct of that type
+    LLVMMetadataRef tbaaAccessTag( LLVMTypeRef accessType, LLVMTypeRef containerType, unsigned long long offset );
+
+    // Record a function's definition, and each direct call it makes
+    void noteCall( const std::string &caller, const char *callee = nullptr );
+    const CallGraph &getCallGraph() const {
+        return callGraph;
+    }
+
     void dump();
+
+private:
+    void reportStructLayout(
+            LLVMTypeRef llvmStruct, const std::vector<LoweredMember> &members, const StructLayout &layout ) const;
+    // Replace the functions selected with --target-clones that target defines with their variants and an ifunc
+    void buildTargetClones( LLVMModuleRef target );
 };
 
 #endif // CODE_GEN_H
@@ -0,0 +1,736 @@
+/* This file is part of the Practical programming langauge. https://github.com/Practical/practical-sa
+ *
+ * This file is file is copyright (C) 2018-2020 by its authors.
+ * You can see the file's authors in the AUTHORS file in the project's home repository.
+ *
+ * This is available under the Boost license. The license's text is available under the LICENSE file in the project's
+ * home directory.
+ */
+#include "config.h"
+
+#include "const_eval.h"
+
+#include "llvm_ext.h"
+#include "support.h"
+
+#include <llvm-c/ExecutionEngine.h>
+#include <llvm-c/Target.h>
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Charged against the memory limit on every call, on top of the callee's locals (return address, saved registers)
+constexpr unsigned long long CallOverhead = 64;
+// The evaluation thread's stack, per byte of the memory limit. Leaves room for the spills and temporaries the
+// accounting doesn't see, so that the limit is hit long before the stack overflows
+constexpr size_t StackPerAccountedByte = 8;
+constexpr size_t MinimalStack = 8<<20;
+
+enum class StopReason {
+    Steps,
+    Memory,
+    Division,
+    NullPointer,
+    Unreachable,
+};
+
+// State of the evaluation running on this thread. The instrumented code calls the functions below, which longjmp
+// out of it when it must stop
+struct Sandbox {
+    unsigned long long stepsLeft;
+    unsigned long long memoryLeft;
+    StopReason reason;
+    jmp_buf exit;
+};
+
+thread_local Sandbox *sandbox;
+
+[[noreturn]] void stop( StopReason reason ) {
+    sandbox->reason = reason;
+    longjmp( sandbox->exit, 1 );
+}
+
+void sandboxStep() {
+    if( sandbox->stepsLeft==0 )
+        stop( StopReason::Steps );
+
+    --sandbox->stepsLeft;
+}
+
+void sandboxEnter( uint64_t frameSize ) {
+    if( frameSize + CallOverhead > sandbox->memoryLeft )
+        stop( StopReason::Memory );
+
+    sandbox->memoryLeft -= frameSize + CallOverhead;
+}
+
+void sandboxLeave( uint64_t frameSize ) {
+    sandbox->memoryLeft += frameSize + CallOverhead;
+}
+
+// signedBits is the width of a signed division's operands, or 0 for unsigned division
+void sandboxCheckDivision( int64_t dividend, int64_t divisor, uint32_t signedBits ) {
+    if( divisor==0 )
+        stop( StopReason::Division );
+
+    if( signedBits!=0 && divisor==-1 ) {
+        int64_t minimum = signedBits==64 ? INT64_MIN : -(int64_t(1) << (signedBits-1));
+        if( dividend==minimum )
+            stop( StopReason::Division );
+    }
+}
+
+void sandboxCheckPointer( const void *pointer ) {
+    if( pointer==nullptr )
+        stop( StopReason::NullPointer );
+}
+
+void sandboxUnreachable() {
+    stop( StopReason::Unreachable );
+}
+
+// Runs work on a thread of its own, with a stack of the given size
+template< typename Work >
+void runOnStack( size_t stackSize, Work &work ) {
+    pthread_attr_t attributes;
+    pthread_attr_init( &attributes );
+    pthread_attr_setstacksize( &attributes, stackSize );
+
+    pthread_t thread;
+    int error = pthread_create(
+            &thread, &attributes,
+            []( void *argument ) -> void * {
+                (*static_cast<Work *>(argument))();
+                return nullptr;
+            },
+            &work );
+    pthread_attr_destroy( &attributes );
+
+    if( error!=0 ) {
+        std::string msg = std::string("Failed to create the compile time evaluation thread: ") + strerror(error);
+        emitMsg(MsgLevel::Fatal, PACKAGE_NAME, msg.c_str());
+        abort();
+    }
+
+    pthread_join( thread, nullptr );
+}
+
+bool isEvaluableType( LLVMTypeRef type ) {
+    return LLVMGetTypeKind(type)==LLVMIntegerTypeKind && LLVMGetIntTypeWidth(type)<=64;
+}
+
+bool isTrapIntrinsic( LLVMValueRef function ) {
+    size_t length;
+    const char *name = LLVMGetValueName2( function, &length );
+
+    return strcmp(name, "llvm.trap")==0 || strcmp(name, "llvm.debugtrap")==0 || strcmp(name, "llvm.ubsantrap")==0;
+}
+
+std::string functionName( LLVMValueRef function ) {
+    size_t length;
+    const char *name = LLVMGetValueName2( function, &length );
+
+    return std::string( name, length );
+}
+
+class Evaluator {
+    LLVMModuleRef module;
+    const ConstEvalOptions &options;
+    std::string fileName;
+
+    // Functions that neither read nor write anything but their arguments, constant globals and their own locals
+    std::unordered_set<LLVMValueRef> pureFunctions;
+
+    // Whether each call seen can be evaluated, and those that can in the order they were found
+    std::unordered_map< LLVMValueRef, bool > candidates;
+    std::vector<LLVMValueRef> candidateOrder;
+    // Results of the evaluated calls, empty where evaluation stopped
+    std::unordered_map< LLVMValueRef, std::optional<unsigned long long> > callResults;
+
+    // Callees get a wrapper in the JIT compiled module with the signature uint64_t (const uint64_t *arguments)
+    std::unordered_map< LLVMValueRef, std::string > wrapperNames;
+    std::unordered_map< LLVMValueRef, uint64_t > wrapperAddresses;
+    std::map< std::pair< LLVMValueRef, std::vector<unsigned long long> >, std::optional<unsigned long long> >
+            evaluations;
+
+public:
+    Evaluator( LLVMModuleRef module, const ConstEvalOptions &options ) : module(module), options(options) {
+        size_t length;
+        const char *name = LLVMGetSourceFileName( module, &length );
+        fileName = std::string( name, length );
+    }
+
+    size_t run() {
+        findPureFunctions();
+
+        for( LLVMValueRef function = LLVMGetFirstFunction(module); function!=nullptr;
+                function = LLVMGetNextFunction(function) )
+        {
+            forEachInstruction( function, [&]( LLVMValueRef instruction ) {
+                if( LLVMIsACallInst(instruction) && isCandidate(instruction) )
+                    candidateOrder.push_back( instruction );
+            } );
+        }
+
+        if( candidateOrder.empty() )
+            return 0;
+
+        LLVMExecutionEngineRef engine = createEngine();
+        if( engine==nullptr )
+            return 0;
+
+        auto work = [&]() {
+            for( auto &wrapper : wrapperNames ) {
+                wrapperAddresses[wrapper.first] = LLVMGetFunctionAddress( engine, wrapper.second.c_str() );
+            }
+
+            for( LLVMValueRef call : candidateOrder ) {
+                evaluate( call );
+            }
+        };
+        runOnStack( std::max( MinimalStack, size_t(options.maxMemory) * StackPerAccountedByte ), work );
+        LLVMDisposeExecutionEngine( engine );
+
+        size_t replaced = 0;
+        for( LLVMValueRef call : candidateOrder ) {
+            const std::optional<unsigned long long> &result = callResults[call];
+            if( !result )
+                continue;
+
+            LLVMReplaceAllUsesWith( call, LLVMConstInt( LLVMTypeOf(call), *result, false ) );
+            LLVMInstructionEraseFromParent( call );
+            ++replaced;
+        }
+
+        return replaced;
+    }
+
+private:
+    template< typename Callback >
+    static void forEachInstruction( LLVMValueRef function, Callback callback ) {
+        for( LLVMBasicBlockRef block = LLVMGetFirstBasicBlock(function); block!=nullptr;
+                block = LLVMGetNextBasicBlock(block) )
+        {
+            LLVMValueRef instruction = LLVMGetFirstInstruction(block);
+            while( instruction!=nullptr ) {
+                // The callback may insert instructions before this one
+                LLVMValueRef next = LLVMGetNextInstruction(instruction);
+                callback( instruction );
+                instruction = next;
+            }
+        }
+    }
+
+    static bool containsGlobal( LLVMValueRef constant ) {
+        if( LLVMIsAGlobalValue(constant) )
+            return true;
+
+        int numOperands = LLVMGetNumOperands(constant);
+        for( int i=0; i<numOperands; ++i ) {
+            if( containsGlobal( LLVMGetOperand(constant, i) ) )
+                return true;
+        }
+
+        return false;
+    }
+
+    // Whether value, or a constant expression it is made of, refers to state outside the function. Constant globals
+    // are not state, unless they point to other globals
+    static bool referencesState( LLVMValueRef value ) {
+        if( LLVMIsAGlobalVariable(value) ) {
+            LLVMValueRef initializer = LLVMGetInitializer(value);
+            return !LLVMIsGlobalConstant(value) || LLVMIsThreadLocal(value) || initializer==nullptr ||
+                    containsGlobal(initializer);
+        }
+        if( LLVMIsAGlobalValue(value) )
+            return true;
+        if( !LLVMIsAConstant(value) )
+            return false;
+
+        int numOperands = LLVMGetNumOperands(value);
+        for( int i=0; i<numOperands; ++i ) {
+            if( referencesState( LLVMGetOperand(value, i) ) )
+                return true;
+        }
+
+        return false;
+    }
+
+    bool isPureInstruction( LLVMValueRef instruction, LLVMValueRef function ) const {
+        int numOperands = LLVMGetNumOperands(instruction);
+
+        switch( LLVMGetInstructionOpcode(instruction) ) {
+        case LLVMCall:
+        {
+            LLVMValueRef callee = LLVMGetCalledValue(instruction);
+            if( !LLVMIsAFunction(callee) )
+                return false;
+
+            if( LLVMGetIntrinsicID(callee)!=0 ) {
+                if( LLVMIsAMemIntrinsic(instruction) &&
+                        LLVMIsAGlobalValue( underlyingObject( LLVMGetOperand(instruction, 0) ) ) )
+                    return false;
+            } else if( pureFunctions.count(callee)==0 ) {
+                return false;
+            }
+
+            // The callee is the last operand
+            numOperands = LLVMGetNumArgOperands(instruction);
+            break;
+        }
+        case LLVMInvoke:
+        case LLVMCallBr:
+        case LLVMAtomicRMW:
+        case LLVMAtomicCmpXchg:
+        case LLVMFence:
+            return false;
+        case LLVMLoad:
+            if( LLVMGetVolatile(instruction) || LLVMGetOrdering(instruction)!=LLVMAtomicOrderingNotAtomic )
+                return false;
+            break;
+        case LLVMStore:
+            if( LLVMGetVolatile(instruction) || LLVMGetOrdering(instruction)!=LLVMAtomicOrderingNotAtomic )
+                return false;
+            if( LLVMIsAGlobalValue( underlyingObject( LLVMGetOperand(instruction, 1) ) ) )
+                return false;
+            break;
+        case LLVMAlloca:
+            // Only fixed size locals are accounted for
+            if( LLVMGetInstructionParent(instruction)!=LLVMGetEntryBasicBlock(function) ||
+                    !LLVMIsAConstantInt( LLVMGetOperand(instruction, 0) ) )
+                return false;
+            break;
+        case LLVMUDiv:
+        case LLVMSDiv:
+        case LLVMURem:
+        case LLVMSRem:
+            if( !isEvaluableType( LLVMTypeOf(instruction) ) )
+                return false;
+            break;
+        default:
+            break;
+        }
+
+        for( int i=0; i<numOperands; ++i ) {
+            if( referencesState( LLVMGetOperand(instruction, i) ) )
+                return false;
+        }
+
+        return true;
+    }
+
+    // Start from every defined function, and drop those that do anything impure (including calling a dropped
+    // function) until none are dropped
+    void findPureFunctions() {
+        for( LLVMValueRef function = LLVMGetFirstFunction(module); function!=nullptr;
+                function = LLVMGetNextFunction(function) )
+        {
+            if( LLVMCountBasicBlocks(function)!=0 )
+                pureFunctions.insert( function );
+        }
+
+        bool changed;
+        do {
+            changed = false;
+
+            for( auto iter = pureFunctions.begin(); iter!=pureFunctions.end(); ) {
+                bool pure = true;
+                forEachInstruction( *iter, [&]( LLVMValueRef instruction ) {
+                    pure = pure && isPureInstruction( instruction, *iter );
+                } );
+
+                if( pure ) {
+                    ++iter;
+                } else {
+                    iter = pureFunctions.erase(iter);
+                    changed = true;
+                }
+            }
+        } while( changed );
+    }
+
+    // A call to a pure function with an integer signature, whose arguments are constants or calls that can be
+    // evaluated themselves
+    bool isCandidate( LLVMValueRef call ) {
+        auto iter = candidates.find(call);
+        if( iter!=candidates.end() )
+            return iter->second;
+
+        // Guards against cycles, which are possible in unreachable code
+        candidates[call] = false;
+
+        LLVMValueRef callee = LLVMGetCalledValue(call);
+        if( !LLVMIsAFunction(callee) || pureFunctions.count(callee)==0 )
+            return false;
+
+        LLVMTypeRef functionType = LLVMGlobalGetValueType(callee);
+        if( LLVMIsFunctionVarArg(functionType) || !isEvaluableType( LLVMGetReturnType(functionType) ) )
+            return false;
+
+        unsigned numArguments = LLVMGetNumArgOperands(call);
+        for( unsigned i=0; i<numArguments; ++i ) {
+            LLVMValueRef argument = LLVMGetOperand(call, i);
+            if( !isEvaluableType( LLVMTypeOf(argument) ) )
+                return false;
+            if( !LLVMIsAConstantInt(argument) && !( LLVMIsACallInst(argument) && isCandidate(argument) ) )
+                return false;
+        }
+
+        candidates[call] = true;
+        wrapperNames.emplace( callee, std::string() );
+        return true;
+    }
+
+    LLVMExecutionEngineRef createEngine() {
+        LLVMLinkInMCJIT();
+        LLVMInitializeNativeTarget();
+        LLVMInitializeNativeAsmPrinter();
+
+        LLVMModuleRef clone = LLVMCloneModule(module);
+        prepareClone( clone );
+
+        LLVMMCJITCompilerOptions engineOptions;
+        LLVMInitializeMCJITCompilerOptions( &engineOptions, sizeof(engineOptions) );
+        engineOptions.OptLevel = 2;
+
+        LLVMExecutionEngineRef engine;
+        char *error = nullptr;
+        if( LLVMCreateMCJITCompilerForModule( &engine, clone, &engineOptions, sizeof(engineOptions), &error ) ) {
+            std::string msg = std::string("Compile time evaluation is unavailable: ") + error;
+            emitMsg(MsgLevel::Warning, fileName.c_str(), msg.c_str());
+            LLVMDisposeMessage(error);
+            LLVMDisposeModule(clone);
+
+            return nullptr;
+        }
+
+        static const std::pair< const char *, void * > hostFunctions[] = {
+            { "practical.sandbox.step", reinterpret_cast<void *>(&sandboxStep) },
+            { "practical.sandbox.enter", reinterpret_cast<void *>(&sandboxEnter) },
+            { "practical.sandbox.leave", reinterpret_cast<void *>(&sandboxLeave) },
+            { "practical.sandbox.check_division", reinterpret_cast<void *>(&sandboxCheckDivision) },
+            { "practical.sandbox.check_pointer", reinterpret_cast<void *>(&sandboxCheckPointer) },
+            { "practical.sandbox.unreachable", reinterpret_cast<void *>(&sandboxUnreachable) },
+        };
+        for( auto &hostFunction : hostFunctions ) {
+            LLVMAddGlobalMapping( engine, LLVMGetNamedFunction(clone, hostFunction.first), hostFunction.second );
+        }
+
+        return engine;
+    }
+
+    // Leave only what the pure functions need, instrument them, and add the wrappers evaluations call
+    void prepareClone( LLVMModuleRef clone ) {
+        for( LLVMValueRef function = LLVMGetFirstFunction(clone); function!=nullptr;
+                function = LLVMGetNextFunction(function) )
+        {
+            if( LLVMCountBasicBlocks(function)==0 )
+                continue;
+
+            LLVMValueRef original = LLVMGetNamedFunction( module, LLVMGetValueName(function) );
+            if( pureFunctions.count(original)==0 )
+                deleteFunctionBody( function );
+        }
+
+        // Pure functions only refer to constant globals. Evaluations get their own writable copies of those
+        for( LLVMValueRef global = LLVMGetFirstGlobal(clone); global!=nullptr; global = LLVMGetNextGlobal(global) ) {
+            if( referencesState(global) ) {
+                LLVMSetInitializer( global, nullptr );
+                LLVMSetLinkage( global, LLVMExternalLinkage );
+            } else {
+                LLVMSetGlobalConstant( global, false );
+            }
+        }
+
+        Instrumentation instrumentation( clone );
+        for( LLVMValueRef function = LLVMGetFirstFunction(clone); function!=nullptr;
+                function = LLVMGetNextFunction(function) )
+        {
+            if( LLVMCountBasicBlocks(function)!=0 )
+                instrumentation.instrument( function );
+        }
+
+        unsigned index = 0;
+        for( auto &wrapper : wrapperNames ) {
+            wrapper.second = "practical.evaluate." + std::to_string(index++);
+            buildWrapper(
+                    clone, instrumentation.builder, LLVMGetNamedFunction( clone, LLVMGetValueName(wrapper.first) ),
+                    wrapper.second.c_str() );
+        }
+    }
+
+    struct Instrumentation {
+        LLVMModuleRef module;
+        LLVMBuilderRef builder;
+        LLVMTargetDataRef dataLayout;
+        LLVMTypeRef int32Type, int64Type, voidPtrType;
+        LLVMTypeRef stepType, frameType, checkDivisionType, checkPointerType;
+        LLVMValueRef step, enter, leave, checkDivision, checkPointer, unreachable;
+
+        explicit Instrumentation( LLVMModuleRef module ) : module(module) {
+            LLVMContextRef context = LLVMGetModuleContext(module);
+            builder = LLVMCreateBuilderInContext(context);
+            dataLayout = LLVMGetModuleDataLayout(module);
+
+            LLVMTypeRef voidType = LLVMVoidTypeInContext(context);
+            int32Type = LLVMInt32TypeInContext(context);
+            int64Type = LLVMInt64TypeInContext(context);
+            voidPtrType = LLVMPointerType( LLVMInt8TypeInContext(context), 0 );
+
+            stepType = LLVMFunctionType( voidType, nullptr, 0, false );
+            frameType = LLVMFunctionType( voidType, &int64Type, 1, false );
+            LLVMTypeRef divisionArguments[] = { int64Type, int64Type, int32Type };
+            checkDivisionType = LLVMFunctionType( voidType, divisionArguments, 3, false );
+            checkPointerType = LLVMFunctionType( voidType, &voidPtrType, 1, false );
+
+            step = LLVMAddFunction( module, "practical.sandbox.step", stepType );
+            enter = LLVMAddFunction( module, "practical.sandbox.enter", frameType );
+            leave = LLVMAddFunction( module, "practical.sandbox.leave", frameType );
+            checkDivision = LLVMAddFunction( module, "practical.sandbox.check_division", checkDivisionType );
+            checkPointer = LLVMAddFunction( module, "practical.sandbox.check_pointer", checkPointerType );
+            unreachable = LLVMAddFunction( module, "practical.sandbox.unreachable", stepType );
+        }
+
+        ~Instrumentation() {
+            LLVMDisposeBuilder(builder);
+        }
+
+        void instrument( LLVMValueRef function ) {
+            LLVMBasicBlockRef entry = LLVMGetEntryBasicBlock(function);
+
+            // Locals are all allocated in the entry block (checked by isPureInstruction)
+            unsigned long long frameSize = 0;
+            LLVMValueRef firstInstruction = nullptr;
+            for( LLVMValueRef instruction = LLVMGetFirstInstruction(entry); instruction!=nullptr;
+                    instruction = LLVMGetNextInstruction(instruction) )
+            {
+                if( LLVMIsAAllocaInst(instruction) ) {
+                    frameSize += LLVMABISizeOfType( dataLayout, LLVMGetAllocatedType(instruction) ) *
+                            LLVMConstIntGetZExtValue( LLVMGetOperand(instruction, 0) );
+                } else if( firstInstruction==nullptr ) {
+                    firstInstruction = instruction;
+                }
+            }
+
+            LLVMValueRef frameSizeValue = LLVMConstInt( int64Type, frameSize, false );
+            LLVMPositionBuilderBefore( builder, firstInstruction );
+            LLVMBuildCall2( builder, frameType, enter, &frameSizeValue, 1, "" );
+
+            for( LLVMBasicBlockRef block = LLVMGetFirstBasicBlock(function); block!=nullptr;
+                    block = LLVMGetNextBasicBlock(block) )
+            {
+                LLVMValueRef instruction = LLVMGetFirstInstruction(block);
+                while( LLVMIsAPHINode(instruction) || LLVMIsAAllocaInst(instruction) )
+                    instruction = LLVMGetNextInstruction(instruction);
+
+                LLVMPositionBuilderBefore( builder, instruction );
+                LLVMBuildCall2( builder, stepType, step, nullptr, 0, "" );
+            }
+
+            forEachInstruction( function, [&]( LLVMValueRef instruction ) {
+                instrumentInstruction( instruction, frameSizeValue );
+            } );
+        }
+
+        void instrumentInstruction( LLVMValueRef instruction, LLVMValueRef frameSize ) {
+            switch( LLVMGetInstructionOpcode(instruction) ) {
+            case LLVMRet:
+                LLVMPositionBuilderBefore( builder, instruction );
+                LLVMBuildCall2( builder, frameType, leave, &frameSize, 1, "" );
+                break;
+            case LLVMCall:
+            {
+                // A tail call would skip the caller's sandbox.leave
+                LLVMSetTailCall( instruction, false );
+
+                LLVMValueRef callee = LLVMGetCalledValue(instruction);
+                if( isTrapIntrinsic(callee) ) {
+                    LLVMPositionBuilderBefore( builder, instruction );
+                    LLVMBuildCall2( builder, stepType, unreachable, nullptr, 0, "" );
+                } else if( LLVMIsAMemIntrinsic(instruction) ) {
+                    checkAddress( instruction, LLVMGetOperand(instruction, 0) );
+                    if( !LLVMIsAMemSetInst(instruction) )
+                        checkAddress( instruction, LLVMGetOperand(instruction, 1) );
+                }
+                break;
+            }
+            case LLVMUnreachable:
+                LLVMPositionBuilderBefore( builder, instruction );
+                LLVMBuildCall2( builder, stepType, unreachable, nullptr, 0, "" );
+                break;
+            case LLVMLoad:
+                checkAddress( instruction, LLVMGetOperand(instruction, 0) );
+                break;
+            case LLVMStore:
+                checkAddress( instruction, LLVMGetOperand(instruction, 1) );
+                break;
+            case LLVMUDiv:
+            case LLVMURem:
+                checkDivisionOperands( instruction, false );
+                break;
+            case LLVMSDiv:
+            case LLVMSRem:
+                checkDivisionOperands( instruction, true );
+                break;
+            default:
+                break;
+            }
+        }
+
+        // Locals and globals are always valid. Anything else may be null
+        void checkAddress( LLVMValueRef instruction, LLVMValueRef pointer ) {
+            LLVMValueRef object = underlyingObject(pointer);
+            if( LLVMIsAAllocaInst(object) || LLVMIsAGlobalValue(object) )
+                return;
+
+            LLVMPositionBuilderBefore( builder, instruction );
+            LLVMValueRef argument = LLVMBuildPointerCast( builder, object, voidPtrType, "" );
+            LLVMBuildCall2( builder, checkPointerType, checkPointer, &argument, 1, "" );
+        }
+
+        void checkDivisionOperands( LLVMValueRef instruction, bool isSigned ) {
+            LLVMPositionBuilderBefore( builder, instruction );
+
+            LLVMValueRef arguments[3];
+            for( unsigned i=0; i<2; ++i ) {
+                LLVMValueRef operand = LLVMGetOperand(instruction, i);
+                arguments[i] = isSigned ?
+                        LLVMBuildSExtOrBitCast( builder, operand, int64Type, "" ) :
+                        LLVMBuildZExtOrBitCast( builder, operand, int64Type, "" );
+            }
+            arguments[2] = LLVMConstInt(
+                    int32Type, isSigned ? LLVMGetIntTypeWidth( LLVMTypeOf(instruction) ) : 0, false );
+
+            LLVMBuildCall2( builder, checkDivisionType, checkDivision, arguments, 3, "" );
+        }
+    };
+
+    // uint64_t name( const uint64_t *arguments ): calls function with the arguments truncated to their types, and
+    // returns its result zero extended
+    static void buildWrapper( LLVMModuleRef clone, LLVMBuilderRef builder, LLVMValueRef function, const char *name ) {
+        LLVMContextRef context = LLVMGetModuleContext(clone);
+        LLVMTypeRef int64Type = LLVMInt64TypeInContext(context);
+        LLVMTypeRef argumentsType = LLVMPointerType( int64Type, 0 );
+        LLVMTypeRef functionType = LLVMGlobalGetValueType(function);
+
+        LLVMValueRef wrapper = LLVMAddFunction( clone, name, LLVMFunctionType( int64Type, &argumentsType, 1, false ) );
+        LLVMPositionBuilderAtEnd( builder, LLVMAppendBasicBlockInContext( context, wrapper, "" ) );
+
+        unsigned numArguments = LLVMCountParamTypes(functionType);
+        std::vector<LLVMTypeRef> parameterTypes( numArguments );
+        LLVMGetParamTypes( functionType, parameterTypes.data() );
+
+        std::vector<LLVMValueRef> arguments;
+        arguments.reserve( numArguments );
+        for( unsigned i=0; i<numArguments; ++i ) {
+            LLVMValueRef index = LLVMConstInt( int64Type, i, false );
+            LLVMValueRef address = LLVMBuildGEP2( builder, int64Type, LLVMGetParam(wrapper, 0), &index, 1, "" );
+            LLVMValueRef argument = LLVMBuildLoad2( builder, int64Type, address, "" );
+            arguments.push_back( LLVMBuildTruncOrBitCast( builder, argument, parameterTypes[i], "" ) );
+        }
+
+        LLVMValueRef result = LLVMBuildCall2(
+                builder, functionType, function, arguments.data(), arguments.size(), "" );
+        LLVMBuildRet( builder, LLVMBuildZExtOrBitCast( builder, result, int64Type, "" ) );
+    }
+
+    std::optional<unsigned long long> evaluate( LLVMValueRef call ) {
+        auto known = callResults.find(call);
+        if( known!=callResults.end() )
+            return known->second;
+
+        std::optional<unsigned long long> &result = callResults[call];
+
+        unsigned numArguments = LLVMGetNumArgOperands(call);
+        std::vector<unsigned long long> arguments;
+        arguments.reserve( numArguments );
+        for( unsigned i=0; i<numArguments; ++i ) {
+            LLVMValueRef argument = LLVMGetOperand(call, i);
+            if( LLVMIsAConstantInt(argument) ) {
+                arguments.push_back( LLVMConstIntGetZExtValue(argument) );
+            } else {
+                std::optional<unsigned long long> value = evaluate( argument );
+                if( !value )
+                    return result;
+
+                arguments.push_back( *value );
+            }
+        }
+
+        LLVMValueRef callee = LLVMGetCalledValue(call);
+        auto key = std::make_pair( callee, std::move(arguments) );
+        auto evaluation = evaluations.find(key);
+        if( evaluation==evaluations.end() ) {
+            evaluation = evaluations.emplace( key, runSandboxed( callee, key.second ) ).first;
+        }
+
+        result = evaluation->second;
+        return result;
+    }
+
+    std::optional<unsigned long long> runSandboxed(
+            LLVMValueRef callee, const std::vector<unsigned long long> &arguments )
+    {
+        auto function = reinterpret_cast< uint64_t (*)( const unsigned long long * ) >( wrapperAddresses[callee] );
+
+        Sandbox state;
+        state.stepsLeft = options.maxSteps;
+        state.memoryLeft = options.maxMemory;
+        sandbox = &state;
+
+        if( setjmp( state.exit )==0 ) {
+            return function( arguments.data() );
+        }
+
+        std::string msg = "Compile time evaluation of " + functionName(callee) + "(";
+        for( size_t i=0; i<arguments.size(); ++i ) {
+            if( i!=0 )
+                msg += ", ";
+            msg += std::to_string( arguments[i] );
+        }
+        msg += ") ";
+
+        switch( state.reason ) {
+        case StopReason::Steps:
+            msg += "did not finish within " + std::to_string(options.maxSteps) + " steps";
+            break;
+        case StopReason::Memory:
+            msg += "needs more than " + std::to_string(options.maxMemory) + " bytes of stack";
+            break;
+        case StopReason::Division:
+            msg += "divides by zero or overflows a division";
+            break;
+        case StopReason::NullPointer:
+            msg += "accesses a null pointer";
+            break;
+        case StopReason::Unreachable:
+            msg += "reaches unreachable code";
+            break;
+        }
+        msg += ". The call is left to run time";
+        emitMsg(MsgLevel::Warning, fileName.c_str(), msg.c_str());
+
+        return std::nullopt;
+    }
+};
+
+} // anonymous namespace
+
+size_t evaluateConstantCalls( LLVMModuleRef module, const ConstEvalOptions &options ) {
+    Evaluator evaluator( module, options );
+
+    return evaluator.run();
+}
@@ -0,0 +1,28 @@
+/* This file is part of the Practical programming langauge. https://github.com/Practical/practical-sa
+ *
+ * To the extent header files enjoy copyright protection, this file is file is copyright (C) 2018-2020 by its authors
+ * You can see the file's authors in the AUTHORS file in the project's home repository.
+ *
+ * This is available under the Boost license. The license's text is available under the LICENSE file in the project's
+ * home directory.
+ */
+#ifndef CONST_EVAL_H
+#define CONST_EVAL_H
+
+#include "options.h"
+
+#include <llvm-c/Core.h>
+
+#include <stddef.h>
+
+// Evaluate calls to pure functions whose arguments are all constant at compile time, and replace them with their
+// results.
+//
+// The module's own code is JIT compiled and run, instrumented so that no evaluation runs longer, or uses more stack,
+// than options allow, and so that division by zero, null pointer accesses and unreachable code stop the evaluation
+// rather than the compiler. A call whose evaluation stops is left for run time, with a warning.
+//
+// Returns the number of calls replaced.
+size_t evaluateConstantCalls( LLVMModuleRef module, const ConstEvalOptions &options );
+
+#endif // CONST_EVAL_H
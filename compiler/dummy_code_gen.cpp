@@ -10,6 +10,8 @@
 
 #include "lookup_context.h"
 #include "object_output.h"
+#include "pipeline.h"
+#include "remarks.h"
 
 JumpPointData::JumpPointData( Type type ) : type(type) {
 }
@@ -302,3 +304,14 @@ std::shared_ptr<FunctionGen> ModuleGenImpl::handleFunction() {
 }
 
 ObjectOutput::ObjectOutput(std::filesystem::path outputFile, const char *targetTriplet, ModuleGenImpl &module) {}
+StreamingOutput::StreamingOutput(const char *targetTriplet, const CompilerOptions &options) :
+    stackUsage( options.stackUsage ) {}
+StreamingOutput::~StreamingOutput() {}
+OptimizationRemarks::OptimizationRemarks( const RemarkOptions &options, std::filesystem::path outputFile ) {}
+OptimizationRemarks::~OptimizationRemarks() {}
+
+// No pipelining, callbacks are printed as they come
+CodeGenPipeline::CodeGenPipeline( ModuleGenImpl &backEnd ) : backEnd( backEnd ) {}
+CodeGenPipeline::~CodeGenPipeline() {}
+ModuleGen *CodeGenPipeline::getFrontEnd() { return &backEnd; }
+void CodeGenPipeline::finish() {}
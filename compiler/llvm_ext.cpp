@@ -0,0 +1,280 @@
+/* This file is part of the Practical programming langauge. https://github.com/Practical/practical-sa
+ *
+ * This file is file is copyright (C) 2018-2020 by its authors.
+ * You can see the file's authors in the AUTHORS file in the project's home repository.
+ *
+ * This is available under the Boost license. The license's text is available under the LICENSE file in the project's
+ * home directory.
+ */
+#include "llvm_ext.h"
+
+#include "options.h"
+
+#include <llvm/Analysis/InstructionSimplify.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/DiagnosticHandler.h>
+#include <llvm/IR/DiagnosticInfo.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/LLVMRemarkStreamer.h>
+#include <llvm/IR/Metadata.h>
+#include <llvm/Remarks/RemarkStreamer.h>
+#include <llvm/Support/Regex.h>
+#include <llvm/Support/ToolOutputFile.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+#include <vector>
+
+using namespace llvm;
+
+LLVMMetadataRef createDistinctMDNode( LLVMContextRef ctx, LLVMMetadataRef *operands, size_t count ) {
+    std::vector<Metadata *> mds;
+    mds.reserve(count);
+    for( size_t i=0; i<count; ++i ) {
+        mds.push_back( unwrap(operands[i]) );
+    }
+
+    return wrap( MDNode::getDistinct( *unwrap(ctx), mds ) );
+}
+
+LLVMMetadataRef createLoopID( LLVMContextRef ctx, LLVMMetadataRef *properties, size_t count ) {
+    std::vector<Metadata *> mds;
+    mds.reserve(count+1);
+    mds.push_back( nullptr ); // Placeholder for the self reference
+    for( size_t i=0; i<count; ++i ) {
+        mds.push_back( unwrap(properties[i]) );
+    }
+
+    MDNode *loopId = MDNode::getDistinct( *unwrap(ctx), mds );
+    loopId->replaceOperandWith( 0, loopId );
+
+    return wrap( loopId );
+}
+
+void setMustTailCall( LLVMValueRef call ) {
+    unwrap<CallInst>( call )->setTailCallKind( CallInst::TCK_MustTail );
+}
+
+LLVMValueRef stripConstantOffsets( LLVMValueRef pointer, LLVMTargetDataRef dataLayout, int64_t *offset ) {
+    const DataLayout &layout = *unwrap(dataLayout);
+    Value *value = unwrap(pointer);
+
+    APInt accumulated( layout.getIndexTypeSizeInBits( value->getType() ), 0 );
+    const Value *base = value->stripAndAccumulateConstantOffsets( layout, accumulated, true );
+    *offset = accumulated.getSExtValue();
+
+    return wrap( base );
+}
+
+LLVMValueRef simplifyInstruction( LLVMValueRef instruction ) {
+    Instruction *inst = unwrap<Instruction>( instruction );
+    return wrap( SimplifyInstruction( inst, SimplifyQuery( inst->getModule()->getDataLayout(), inst ) ) );
+}
+
+bool computesSameValue( LLVMValueRef earlier, LLVMValueRef later ) {
+    Instruction *earlierInst = unwrap<Instruction>( earlier ), *laterInst = unwrap<Instruction>( later );
+    return earlierInst->getParent()==laterInst->getParent() && earlierInst->comesBefore( laterInst ) &&
+            earlierInst->isIdenticalTo( laterInst );
+}
+
+bool mayAccessMemory( LLVMValueRef instruction ) {
+    return unwrap<Instruction>( instruction )->mayReadOrWriteMemory();
+}
+
+bool mayWriteMemory( LLVMValueRef instruction ) {
+    return unwrap<Instruction>( instruction )->mayWriteToMemory();
+}
+
+LLVMValueRef underlyingObject( LLVMValueRef pointer ) {
+    return wrap( getUnderlyingObject( unwrap(pointer), 0 ) );
+}
+
+void deleteFunctionBody( LLVMValueRef function ) {
+    unwrap<Function>( function )->deleteBody();
+}
+
+LLVMValueRef cloneFunction( LLVMValueRef function, const char *name ) {
+    Function *original = unwrap<Function>( function );
+    Function *clone = Function::Create(
+            original->getFunctionType(), original->getLinkage(), original->getAddressSpace(), name,
+            original->getParent() );
+
+    ValueToValueMapTy valueMap;
+    valueMap[original] = clone;
+    Function::arg_iterator cloneArgument = clone->arg_begin();
+    for( Argument &argument : original->args() ) {
+        cloneArgument->setName( argument.getName() );
+        valueMap[&argument] = &*cloneArgument++;
+    }
+
+    SmallVector<ReturnInst *, 8> returns;
+    CloneFunctionInto( clone, original, valueMap, CloneFunctionChangeType::LocalChangesOnly, returns );
+
+    return wrap( clone );
+}
+
+void setStackUsageOutput( LLVMTargetMachineRef targetMachine, const char *stackUsageFile, bool stackSizeSection ) {
+    TargetOptions &options = reinterpret_cast<TargetMachine *>( targetMachine )->Options;
+    options.StackUsageOutput = stackUsageFile!=nullptr ? stackUsageFile : "";
+    options.EmitStackSizeSection = stackSizeSection;
+}
+
+void setInstructionSelector( LLVMTargetMachineRef targetMachine, InstructionSelector selector ) {
+    TargetMachine *machine = reinterpret_cast<TargetMachine *>( targetMachine );
+    switch( selector ) {
+    case InstructionSelector::Default:
+        break;
+    case InstructionSelector::Fast:
+        machine->setFastISel( true );
+        machine->setGlobalISel( false );
+        break;
+    case InstructionSelector::Global:
+        machine->setFastISel( false );
+        machine->setGlobalISel( true );
+        machine->setGlobalISelAbort( GlobalISelAbortMode::Disable );
+        break;
+    }
+}
+
+namespace {
+
+class RemarkDiagnosticHandler : public DiagnosticHandler {
+    Optional<Regex> passed, missed, analysis;
+    RemarkHandler handler;
+
+    static bool matches( const Optional<Regex> &filter, StringRef passName ) {
+        return filter.hasValue() && filter->match( passName );
+    }
+
+    // Returns why the expression is invalid, if it is
+    static std::string setFilter( Optional<Regex> &filter, const char *expression ) {
+        if( expression==nullptr )
+            return "";
+
+        filter.emplace( expression );
+        std::string error;
+        if( !filter->isValid(error) )
+            return std::string("Invalid remark filter \"") + expression + "\": " + error;
+
+        return "";
+    }
+
+public:
+    RemarkDiagnosticHandler( RemarkHandler handler, void *handlerContext ) :
+        DiagnosticHandler( handlerContext ), handler( handler )
+    {}
+
+    // Sets the filters, or returns why an expression is invalid
+    std::string setFilters( const char *passedFilter, const char *missedFilter, const char *analysisFilter ) {
+        std::string error = setFilter( passed, passedFilter );
+        if( error.empty() )
+            error = setFilter( missed, missedFilter );
+        if( error.empty() )
+            error = setFilter( analysis, analysisFilter );
+
+        return error;
+    }
+
+    bool isPassedOptRemarkEnabled( StringRef passName ) const override {
+        return matches( passed, passName );
+    }
+
+    bool isMissedOptRemarkEnabled( StringRef passName ) const override {
+        return matches( missed, passName );
+    }
+
+    bool isAnalysisRemarkEnabled( StringRef passName ) const override {
+        return matches( analysis, passName );
+    }
+
+    bool isAnyRemarkEnabled() const override {
+        return passed.hasValue() || missed.hasValue() || analysis.hasValue();
+    }
+
+    bool handleDiagnostics( const DiagnosticInfo &info ) override {
+        auto *remark = dyn_cast<DiagnosticInfoOptimizationBase>( &info );
+        if( remark==nullptr )
+            return false;
+
+        // Remarks are also made for the optimization record. Only report those the filters select
+        RemarkInfo reported;
+        if( remark->isPassed() && isPassedOptRemarkEnabled( remark->getPassName() ) )
+            reported.kind = RemarkKind::Passed;
+        else if( remark->isMissed() && isMissedOptRemarkEnabled( remark->getPassName() ) )
+            reported.kind = RemarkKind::Missed;
+        else if( remark->isAnalysis() && isAnalysisRemarkEnabled( remark->getPassName() ) )
+            reported.kind = RemarkKind::Analysis;
+        else
+            return true;
+
+        std::string passName = remark->getPassName().str(), file, message = remark->getMsg();
+        reported.passName = passName.c_str();
+        reported.file = nullptr;
+        reported.line = reported.column = 0;
+        if( remark->isLocationAvailable() ) {
+            DiagnosticLocation location = remark->getLocation();
+            file = location.getRelativePath();
+            reported.file = file.c_str();
+            reported.line = location.getLine();
+            reported.column = location.getColumn();
+        }
+        reported.message = message.c_str();
+        reported.hotness = remark->getHotness().getValueOr(0);
+
+        handler( reported, DiagnosticContext );
+
+        return true;
+    }
+};
+
+} // anonymous namespace
+
+char *setRemarkHandler(
+        LLVMContextRef ctx, const char *passed, const char *missed, const char *analysis, RemarkHandler handler,
+        void *handlerContext )
+{
+    auto diagnosticHandler = std::make_unique<RemarkDiagnosticHandler>( handler, handlerContext );
+    std::string error = diagnosticHandler->setFilters( passed, missed, analysis );
+    if( !error.empty() )
+        return LLVMCreateMessage( error.c_str() );
+
+    unwrap(ctx)->setDiagnosticHandler( std::move(diagnosticHandler) );
+
+    return nullptr;
+}
+
+void setRemarkHotnessThreshold( LLVMContextRef ctx, uint64_t threshold ) {
+    unwrap(ctx)->setDiagnosticsHotnessRequested( true );
+    unwrap(ctx)->setDiagnosticsHotnessThreshold( threshold );
+}
+
+struct OptimizationRecord {
+    LLVMContext *context;
+    std::unique_ptr<ToolOutputFile> file;
+};
+
+OptimizationRecordRef startOptimizationRecord(
+        LLVMContextRef ctx, const char *fileName, const char *format, const char *passes, char **errorMessage )
+{
+    LLVMContext *context = unwrap(ctx);
+    Expected< std::unique_ptr<ToolOutputFile> > file = setupLLVMOptimizationRemarks(
+            *context, fileName, passes!=nullptr ? passes : "", format, context->getDiagnosticsHotnessRequested(),
+            context->getDiagnosticsHotnessThreshold() );
+    if( !file ) {
+        *errorMessage = LLVMCreateMessage( toString( file.takeError() ).c_str() );
+        return nullptr;
+    }
+
+    return new OptimizationRecord{ context, std::move( *file ) };
+}
+
+void finishOptimizationRecord( OptimizationRecordRef record ) {
+    record->context->setLLVMRemarkStreamer( nullptr );
+    record->context->setMainRemarkStreamer( nullptr );
+    record->file->keep();
+
+    delete record;
+}
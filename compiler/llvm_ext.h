@@ -0,0 +1,104 @@
+/* This file is part of the Practical programming langauge. https://github.com/Practical/practical-sa
+ *
+ * To the extent header files enjoy copyright protection, this file is file is copyright (C) 2018-2020 by its authors
+ * You can see the file's authors in the AUTHORS file in the project's home repository.
+ *
+ * This is available under the Boost license. The license's text is available under the LICENSE file in the project's
+ * home directory.
+ */
+#ifndef LLVM_EXT_H
+#define LLVM_EXT_H
+
+// Thin wrappers around LLVM functionality not (yet) exposed through the C interface. Everything else should use
+// the C interface directly.
+
+#include <llvm-c/Core.h>
+#include <llvm-c/Target.h>
+#include <llvm-c/TargetMachine.h>
+
+#include <stdint.h>
+
+enum class InstructionSelector;
+
+// Create a metadata node that is never merged with structurally identical nodes (e.g. for access groups)
+LLVMMetadataRef createDistinctMDNode( LLVMContextRef ctx, LLVMMetadataRef *operands, size_t count );
+
+// Create a loop ID node for "llvm.loop" metadata: a distinct node whose first operand is itself
+LLVMMetadataRef createLoopID( LLVMContextRef ctx, LLVMMetadataRef *properties, size_t count );
+
+// Mark a call as musttail: it is guaranteed to reuse the caller's stack frame
+void setMustTailCall( LLVMValueRef call );
+
+// Strip constant offset GEPs and casts off a pointer. Returns the underlying pointer, and sets offset to the pointer's
+// distance from it in bytes
+LLVMValueRef stripConstantOffsets( LLVMValueRef pointer, LLVMTargetDataRef dataLayout, int64_t *offset );
+
+// The existing value an instruction simplifies to, e.g. by constant folding, identities such as x+0, or casts back to
+// the original type. Null if there is none. Never creates instructions
+LLVMValueRef simplifyInstruction( LLVMValueRef instruction );
+
+// Whether earlier is in the same block as later, before it, and computes the same value from the same operands, flags
+// (such as nsw) included
+bool computesSameValue( LLVMValueRef earlier, LLVMValueRef later );
+
+// Whether the instruction may read or write memory (including through calls)
+bool mayAccessMemory( LLVMValueRef instruction );
+
+// Whether the instruction may write memory (including through calls)
+bool mayWriteMemory( LLVMValueRef instruction );
+
+// The object a pointer points into: the pointer with GEPs and casts, constant or not, stripped off
+LLVMValueRef underlyingObject( LLVMValueRef pointer );
+
+// Delete a function's body, turning it into a declaration
+void deleteFunctionBody( LLVMValueRef function );
+
+// Copy a function definition, attributes included, into a new function of the same module. Calls the function makes
+// to itself call the copy
+LLVMValueRef cloneFunction( LLVMValueRef function, const char *name );
+
+// Have objects emitted by the target machine report their functions' frame sizes: as text, written to
+// stackUsageFile, unless it is null, and in a .stack_sizes section, if stackSizeSection is set
+void setStackUsageOutput( LLVMTargetMachineRef targetMachine, const char *stackUsageFile, bool stackSizeSection );
+
+// Have the target machine select instructions with the given selector. FastISel and GlobalISel both leave what they
+// can't handle to SelectionDAG, rather than failing
+void setInstructionSelector( LLVMTargetMachineRef targetMachine, InstructionSelector selector );
+
+enum class RemarkKind { Passed, Missed, Analysis };
+
+// An optimization remark, as passed to a RemarkHandler
+struct RemarkInfo {
+    RemarkKind kind;
+    const char *passName;
+    // Null if the remark has no source location
+    const char *file;
+    unsigned line, column;
+    const char *message;
+    // 0 if there is no profile
+    uint64_t hotness;
+};
+
+typedef void (*RemarkHandler)( const RemarkInfo &remark, void *handlerContext );
+
+// Have the passes make the remarks of each kind whose pass names match its regular expression, and pass them to
+// handler. A null expression selects no remarks of that kind. Other diagnostics are printed as before.
+//
+// Returns an error message, to be disposed of with LLVMDisposeMessage, if an expression is invalid
+char *setRemarkHandler(
+        LLVMContextRef ctx, const char *passed, const char *missed, const char *analysis, RemarkHandler handler,
+        void *handlerContext );
+
+// Only make remarks about code whose profile count is at least threshold
+void setRemarkHotnessThreshold( LLVMContextRef ctx, uint64_t threshold );
+
+typedef struct OptimizationRecord *OptimizationRecordRef;
+
+// Save all remarks of passes whose names match the passes regular expression (of all passes if it is null) to
+// fileName, in format "yaml" or "bitstream". Returns null, and sets errorMessage, on failure
+OptimizationRecordRef startOptimizationRecord(
+        LLVMContextRef ctx, const char *fileName, const char *format, const char *passes, char **errorMessage );
+// Stop saving remarks, and keep the file
+void finishOptimizationRecord( OptimizationRecordRef record );
+
+#endif // LLVM_EXT_H
@@ -8,27 +8,30 @@
  */
 #include "lookup_context.h"
 
-#include <llvm-c/Core.h>
+#include <map>
+#include <utility>
+
+// Scalar types are registered once, before any code is generated, and live for the rest of the run. std::map never
+// moves its elements, so TypeIds can point into it
+static PracticalSemanticAnalyzer::TypeId scalarTypeId( LLVMTypeRef type, bool isSigned ) {
+    static std::map< std::pair<LLVMTypeRef, bool>, ScalarType > scalarTypes;
 
-static_assert( sizeof(LLVMTypeRef)==sizeof(PracticalSemanticAnalyzer::TypeId::p),
-        "PracticalSemanticAnalyzer::TypeId is not the right size for storing LLVMTypeRef" );
-PracticalSemanticAnalyzer::TypeId BuiltinContextGen::registerVoidType() {
     PracticalSemanticAnalyzer::TypeId ret;
-    ret.p = LLVMVoidType();
+    ret.p = &scalarTypes.try_emplace( { type, isSigned }, ScalarType{ type, isSigned } ).first->second;
     return ret;
 }
 
+PracticalSemanticAnalyzer::TypeId BuiltinContextGen::registerVoidType() {
+    return scalarTypeId( LLVMVoidType(), false );
+}
+
 PracticalSemanticAnalyzer::TypeId BuiltinContextGen::registerBoolType() {
-    PracticalSemanticAnalyzer::TypeId ret;
-    ret.p = LLVMInt1Type();
-    return ret;
+    return scalarTypeId( LLVMInt1Type(), false );
 }
 
 PracticalSemanticAnalyzer::TypeId BuiltinContextGen::registerIntegerType( size_t bitSize, size_t alignment, bool _signed )
 {
-    PracticalSemanticAnalyzer::TypeId ret;
-    ret.p = LLVMIntType(bitSize);
-    return ret;
+    return scalarTypeId( LLVMIntType(bitSize), _signed );
 }
 
 PracticalSemanticAnalyzer::TypeId BuiltinContextGen::registerCharType( size_t bitSize, size_t alignment, bool _signed )
@@ -11,6 +11,18 @@
 
 #include <practical/practical.h>
 
+#include <llvm-c/Core.h>
+
+// What the TypeId of a scalar type points to
+struct ScalarType {
+    LLVMTypeRef type;
+    bool isSigned;
+};
+
+inline const ScalarType &scalarType( PracticalSemanticAnalyzer::TypeId id ) {
+    return *static_cast<const ScalarType *>( id.p );
+}
+
 class BuiltinContextGen : public PracticalSemanticAnalyzer::BuiltinContextGen {
 public:
     virtual PracticalSemanticAnalyzer::TypeId registerVoidType() override final;
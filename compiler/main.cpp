@@ -11,8 +11,14 @@
 #include "code_gen.h"
 #include "lookup_context.h"
 #include "nocopy.h"
+#include "null_code_gen.h"
 #include "object_output.h"
+#include "options.h"
+#include "pipeline.h"
+#include "remarks.h"
+#include "source_input.h"
 #include "support.h"
+#include "trace_writer.h"
 
 #include <practical/errors.h>
 
@@ -21,6 +27,7 @@
 #include <filesystem>
 #include <unistd.h>
 #include <signal.h>
+#include <string.h>
 
 const char *signalToStr(int signum) {
 #define NAME(sig) case sig: return #sig
@@ -61,7 +68,10 @@ void abortHandler(int signum) {
 }
 
 int main(int argc, char *argv[]) {
-    if( argc<2 ) {
+    CompilerOptions options;
+    int firstArgument = parseCommandLine( argc, argv, options );
+
+    if( firstArgument>=argc ) {
         emitMsg(MsgLevel::Error, PACKAGE_NAME, "no input files");
         exit(1);
     }
@@ -71,18 +81,51 @@ int main(int argc, char *argv[]) {
 
     auto arguments = allocateArguments();
 
-    ModuleGenImpl codeGen;
+    ModuleGenImpl codeGen( options );
+    std::unique_ptr<StreamingOutput> streamingOutput;
+    if( options.streaming ) {
+        streamingOutput.reset( new StreamingOutput( TARGET_TRIPLET, options ) );
+        codeGen.setStreamingOutput( streamingOutput.get() );
+    }
+    std::unique_ptr<ModuleGen> frontEndOnlyGen;
+    std::unique_ptr<CodeGenPipeline> pipeline;
+    ModuleGen *moduleGen = &codeGen;
+    if( options.nullBackend ) {
+        frontEndOnlyGen.reset( new NullModuleGen() );
+        moduleGen = frontEndOnlyGen.get();
+    } else if( !options.traceFile.empty() ) {
+        frontEndOnlyGen.reset( new TraceModuleGen( options.traceFile ) );
+        moduleGen = frontEndOnlyGen.get();
+    } else if( options.pipeline ) {
+        pipeline.reset( new CodeGenPipeline( codeGen ) );
+        moduleGen = pipeline->getFrontEnd();
+    }
 
-    std::filesystem::path inputFilePath(argv[1]);
-    if( inputFilePath.extension() != PRACTICAL_SOURCE_FILE_EXTENSION ) {
+    if( strcmp( argv[firstArgument], "-" )==0 ) {
+        if( !options.practicalSource ) {
+            emitMsg(MsgLevel::Error, PACKAGE_NAME, "Reading source from standard input requires -x practical");
+            exit(1);
+        }
+    } else if( !options.practicalSource &&
+            std::filesystem::path( argv[firstArgument] ).extension() != PRACTICAL_SOURCE_FILE_EXTENSION )
+    {
         emitMsg(MsgLevel::Error, PACKAGE_NAME, "Expected a source file with " PRACTICAL_SOURCE_FILE_EXTENSION " extension");
         exit(1);
     }
 
+    SourceInput input( argv[firstArgument] );
+
+    auto outputFileName = input.getPath().filename();
+    outputFileName.replace_extension(".o");
+
+    std::unique_ptr<OptimizationRemarks> remarks;
+    if( options.remarks.enabled() )
+        remarks.reset( new OptimizationRemarks( options.remarks, outputFileName ) );
+
     try {
         ::BuiltinContextGen builtinGen;
         PracticalSemanticAnalyzer::prepare( &builtinGen );
-        int ret = compile(argv[1], arguments.get(), &codeGen);
+        int ret = compile(input.getPath().c_str(), arguments.get(), moduleGen);
         if( ret!=0 )
             return ret;
     } catch(const compile_error &err) {
@@ -91,10 +134,13 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    codeGen.dump();
+    if( frontEndOnlyGen )
+        return 0;
 
-    auto outputFileName = inputFilePath.filename();
-    outputFileName.replace_extension(".o");
+    if( pipeline )
+        pipeline->finish();
+
+    codeGen.dump();
 
     ObjectOutput output(outputFileName, TARGET_TRIPLET, codeGen);
     return 0;
@@ -0,0 +1,54 @@
+/* This file is part of the Practical programming langauge. https://github.com/Practical/practical-sa
+ *
+ * This file is file is copyright (C) 2018-2020 by its authors.
+ * You can see the file's authors in the AUTHORS file in the project's home repository.
+ *
+ * This is available under the Boost license. The license's text is available under the LICENSE file in the project's
+ * home directory.
+ */
+#include "mapped_file.h"
+
+#include "support.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+static void fileError( const char *fileName, const char *operation ) {
+    std::string msg = std::string(operation) + ": " + strerror(errno);
+    emitMsg(MsgLevel::Error, fileName, msg.c_str());
+    exit(1);
+}
+
+MappedFile::MappedFile( const char *fileName ) {
+    int fd = open( fileName, O_RDONLY|O_CLOEXEC );
+    if( fd<0 )
+        fileError( fileName, "Failed to open file" );
+
+    struct stat fileStat;
+    if( fstat( fd, &fileStat )<0 )
+        fileError( fileName, "Failed to stat file" );
+
+    size = fileStat.st_size;
+    if( size>0 ) {
+        void *mapping = mmap( nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        if( mapping==MAP_FAILED )
+            fileError( fileName, "Failed to map file" );
+
+        // The file is consumed front to back
+        madvise( mapping, size, MADV_SEQUENTIAL );
+        data = static_cast<const uint8_t *>(mapping);
+    }
+
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if( data!=nullptr )
+        munmap( const_cast<uint8_t *>(data), size );
+}
@@ -0,0 +1,36 @@
+/* This file is part of the Practical programming langauge. https://github.com/Practical/practical-sa
+ *
+ * To the extent header files enjoy copyright protection, this file is file is copyright (C) 2018-2020 by its authors
+ * You can see the file's authors in the AUTHORS file in the project's home repository.
+ *
+ * This is available under the Boost license. The license's text is available under the LICENSE file in the project's
+ * home directory.
+ */
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include "nocopy.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A read only memory mapping of a whole file
+class MappedFile : private NoCopy {
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+
+public:
+    // Reports an error and exits if the file cannot be mapped
+    explicit MappedFile( const char *fileName );
+    ~MappedFile();
+
+    const uint8_t *getData() const {
+        return data;
+    }
+
+    size_t getSize() const {
+        return size;
+    }
+};
+
+#endif // MAPPED_FILE_H
@@ -0,0 +1,244 @@
+/* This file is part of the Practical programming langauge. https://github.com/Practical/practical-sa
+ *
+ * This file is file is copyright (C) 2018-2020 by its authors.
+ * You can see the file's authors in the AUTHORS file in the project's home repository.
+ *
+ * This is available under the Boost license. The license's text is available under the LICENSE file in the project's
+ * home directory.
+ */
+#include "null_code_gen.h"
+
+#include <iostream>
+
+void NullFunctionGen::functionEnter(
+        String name, StaticType::CPtr returnType, Slice<const ArgumentDeclaration> arguments,
+        String file, const SourceLocation &location)
+{
+    module->countCallback();
+}
+
+void NullFunctionGen::functionLeave() {
+    module->countCallback();
+}
+
+void NullFunctionGen::returnValue(ExpressionId id) {
+    module->countCallback();
+}
+
+void NullFunctionGen::returnValue() {
+    module->countCallback();
+}
+
+void NullFunctionGen::conditionalBranch(
+        ExpressionId id, StaticType::CPtr type, ExpressionId conditionExpression, JumpPointId elsePoint,
+        JumpPointId continuationPoint)
+{
+    module->countCallback();
+}
+
+void NullFunctionGen::setConditionClauseResult( ExpressionId id ) {
+    module->countCallback();
+}
+
+void NullFunctionGen::setJumpPoint(JumpPointId id, String name) {
+    module->countCallback();
+}
+
+void NullFunctionGen::jump(JumpPointId destination) {
+    module->countCallback();
+}
+
+void NullFunctionGen::setLiteral(ExpressionId id, LongEnoughInt value, StaticType::CPtr type) {
+    module->countCallback();
+}
+
+void NullFunctionGen::setLiteral(ExpressionId id, bool value) {
+    module->countCallback();
+}
+
+void NullFunctionGen::setLiteral(ExpressionId id, String value) {
+    module->countCallback();
+}
+
+void NullFunctionGen::setLiteralNull(ExpressionId id, StaticType::CPtr type) {
+    module->countCallback();
+}
+
+void NullFunctionGen::allocateStackVar(ExpressionId id, StaticType::CPtr type, String name) {
+    module->countCallback();
+}
+
+void NullFunctionGen::assign( ExpressionId lvalue, ExpressionId rvalue ) {
+    module->countCallback();
+}
+
+void NullFunctionGen::dereferencePointer( ExpressionId id, StaticType::CPtr type, ExpressionId addr ) {
+    module->countCallback();
+}
+
+void NullFunctionGen::truncateInteger(
+        ExpressionId id, ExpressionId source, StaticType::CPtr sourceType, StaticType::CPtr destType )
+{
+    module->countCallback();
+}
+
+void NullFunctionGen::changeIntegerSign(
+        ExpressionId id, ExpressionId source, StaticType::CPtr sourceType, StaticType::CPtr destType )
+{
+    module->countCallback();
+}
+
+void NullFunctionGen::expandIntegerSigned(
+        ExpressionId id, ExpressionId source, StaticType::CPtr sourceType, StaticType::CPtr destType )
+{
+    module->countCallback();
+}
+
+void NullFunctionGen::expandIntegerUnsigned(
+        ExpressionId id, ExpressionId source, StaticType::CPtr sourceType, StaticType::CPtr destType )
+{
+    module->countCallback();
+}
+
+void NullFunctionGen::callFunctionDirect(
+        ExpressionId id, String name, Slice<const ExpressionId> arguments, StaticType::CPtr returnType )
+{
+    module->countCallback();
+}
+
+void NullFunctionGen::binaryOperatorPlusUnsigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType )
+{
+    module->countCallback();
+}
+
+void NullFunctionGen::binaryOperatorPlusSigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType )
+{
+    module->countCallback();
+}
+
+void NullFunctionGen::binaryOperatorMinusUnsigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType )
+{
+    module->countCallback();
+}
+
+void NullFunctionGen::binaryOperatorMinusSigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType )
+{
+    module->countCallback();
+}
+
+void NullFunctionGen::binaryOperatorMultiplyUnsigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType )
+{
+    module->countCallback();
+}
+
+void NullFunctionGen::binaryOperatorMultiplySigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType )
+{
+    module->countCallback();
+}
+
+void NullFunctionGen::binaryOperatorDivideUnsigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType )
+{
+    module->countCallback();
+}
+
+void NullFunctionGen::operatorEquals(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType )
+{
+    module->countCallback();
+}
+
+void NullFunctionGen::operatorNotEquals(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType )
+{
+    module->countCallback();
+}
+
+void NullFunctionGen::operatorLessThanUnsigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType )
+{
+    module->countCallback();
+}
+
+void NullFunctionGen::operatorLessThanSigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType )
+{
+    module->countCallback();
+}
+
+void NullFunctionGen::operatorLessThanOrEqualsUnsigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType )
+{
+    module->countCallback();
+}
+
+void NullFunctionGen::operatorLessThanOrEqualsSigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType )
+{
+    module->countCallback();
+}
+
+void NullFunctionGen::operatorGreaterThanUnsigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType )
+{
+    module->countCallback();
+}
+
+void NullFunctionGen::operatorGreaterThanSigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType )
+{
+    module->countCallback();
+}
+
+void NullFunctionGen::operatorGreaterThanOrEqualsUnsigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType )
+{
+    module->countCallback();
+}
+
+void NullFunctionGen::operatorGreaterThanOrEqualsSigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType )
+{
+    module->countCallback();
+}
+
+void NullFunctionGen::operatorLogicalNot( ExpressionId id, ExpressionId argument ) {
+    module->countCallback();
+}
+
+void NullModuleGen::moduleEnter(
+        ModuleId id,
+        String name,
+        String file,
+        size_t line,
+        size_t col)
+{
+    countCallback();
+}
+
+void NullModuleGen::moduleLeave(ModuleId id) {
+    countCallback();
+    std::cerr<<"Module "<<id<<": "<<numCallbacks<<" code generation callbacks\n";
+}
+
+void NullModuleGen::declareIdentifier(String name, String mangledName, StaticType::CPtr type) {
+    countCallback();
+}
+
+void NullModuleGen::declareStruct(StaticType::CPtr structType) {
+    countCallback();
+}
+
+void NullModuleGen::defineStruct(StaticType::CPtr strctType) {
+    countCallback();
+}
+
+std::shared_ptr<FunctionGen> NullModuleGen::handleFunction() {
+    return std::shared_ptr<FunctionGen>( new NullFunctionGen(this) );
+}
@@ -6,12 +6,30 @@
  * This is available under the Boost license. The license's text is available under the LICENSE file in the project's
  * home directory.
  */
+#include "config.h"
+
 #include "object_output.h"
 
+#include "llvm_ext.h"
+#include "stack_usage.h"
+#include "support.h"
+
+#include <llvm-c/Support.h>
 #include <llvm-c/Target.h>
 
-ObjectOutput::ObjectOutput(std::filesystem::path outputFile, const char *targetTriplet, ModuleGenImpl &module)
-{
+#include <errno.h>
+#include <malloc.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <fstream>
+
+const char TargetDataLayout[] = "e-S64-p:64:64-i8:8-i16:16-i32:32-i64:64"; // TODO value for x86-64
+
+static LLVMTargetMachineRef createTargetMachine(const char *targetTriplet, InstructionSelector selector) {
     LLVMInitializeAllTargetInfos();
     LLVMInitializeAllTargets();
     LLVMInitializeAllTargetMCs();
@@ -25,12 +43,144 @@ ObjectOutput::ObjectOutput(std::filesystem::path outputFile, const char *targetT
         abort();
     }
 
-    auto targetMachine = LLVMCreateTargetMachine(target, targetTriplet, "generic", "", LLVMCodeGenLevelNone, LLVMRelocDefault, LLVMCodeModelDefault);
+    auto targetMachine = LLVMCreateTargetMachine(
+            target, targetTriplet, "generic", "", LLVMCodeGenLevelNone, LLVMRelocDefault, LLVMCodeModelDefault);
+    if( selector!=InstructionSelector::Default ) {
+        setInstructionSelector( targetMachine, selector );
+
+        // The allocator LLVM picks without optimization, but made explicit: the quickest, as it only looks at one basic
+        // block at a time
+        const char *arguments[] = { "practicomp", "-regalloc=fast" };
+        LLVMParseCommandLineOptions( 2, arguments, nullptr );
+    }
+
+    return targetMachine;
+}
+
+// The stack usage report of an object file
+static std::filesystem::path stackUsageFile(std::filesystem::path objectFile) {
+    return objectFile.replace_extension(".su");
+}
 
-    LLVMSetDataLayout(module.getLLVMModule(), "e-S64-p:64:64-i8:8-i16:16-i32:32-i64:64"); // TODO value for x86-64
-    errorMessage = nullptr;
-    if( LLVMTargetMachineEmitToFile( targetMachine, module.getLLVMModule(), const_cast<char *>(outputFile.c_str()), LLVMObjectFile, &errorMessage )!=0 ) {
+static void emitObject(
+        LLVMTargetMachineRef targetMachine, LLVMModuleRef module, const std::filesystem::path &outputFile,
+        const StackUsageOptions &stackUsage)
+{
+    // Checking the stack bound needs the frame sizes even if no report was asked for
+    bool writeReport = stackUsage.report || stackUsage.limit!=0;
+    if( writeReport || stackUsage.section )
+        setStackUsageOutput(
+                targetMachine, writeReport ? stackUsageFile(outputFile).c_str() : nullptr, stackUsage.section );
+
+    char *errorMessage = nullptr;
+    if( LLVMTargetMachineEmitToFile( targetMachine, module, const_cast<char *>(outputFile.c_str()), LLVMObjectFile, &errorMessage )!=0 ) {
         std::cerr<<"Output to file failed: "<<errorMessage<<"\n";
         abort();
     }
 }
+
+// Bytes of heap currently allocated
+static size_t heapInUse() {
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+ObjectOutput::ObjectOutput(std::filesystem::path outputFile, const char *targetTriplet, ModuleGenImpl &module)
+{
+    const CompilerOptions &options = module.getOptions();
+    const StackUsageOptions &stackUsage = options.stackUsage;
+    if( module.getStreamingOutput()!=nullptr ) {
+        module.getStreamingOutput()->link( outputFile, module.getLLVMModule() );
+    } else {
+        auto targetMachine = createTargetMachine(targetTriplet, options.instructionSelector);
+        emitObject(targetMachine, module.getLLVMModule(), outputFile, stackUsage);
+    }
+
+    if( stackUsage.limit==0 )
+        return;
+
+    bool withinBound = checkStackBound(
+            stackUsageFile(outputFile), module.getCallGraph(), stackUsage.limit,
+            LLVMPointerSize( LLVMGetModuleDataLayout( module.getLLVMModule() ) ) );
+    if( !stackUsage.report )
+        std::filesystem::remove( stackUsageFile(outputFile) );
+    if( !withinBound )
+        exit(1);
+}
+
+StreamingOutput::StreamingOutput(const char *targetTriplet, const CompilerOptions &options) :
+    targetMachine( createTargetMachine(targetTriplet, options.instructionSelector) ), stackUsage( options.stackUsage )
+{
+    if( !directory.create() ) {
+        std::string msg = std::string("Failed to create temporary directory: ") + strerror(errno);
+        emitMsg(MsgLevel::Error, PACKAGE_NAME, msg.c_str());
+        exit(1);
+    }
+}
+
+StreamingOutput::~StreamingOutput() {
+    LLVMDisposeTargetMachine( targetMachine );
+}
+
+void StreamingOutput::emitFunction(LLVMModuleRef functionModule) {
+    auto objectFile = directory.getPath() / ( std::to_string( objects.size() ) + OBJECT_FILE_EXTENSION );
+    emit( functionModule, objectFile );
+
+    size_t heapBefore = heapInUse();
+    LLVMDisposeModule( functionModule );
+    size_t heapAfter = heapInUse();
+
+    if( heapBefore>heapAfter ) {
+        size_t released = heapBefore - heapAfter;
+        releasedBytes += released;
+        largestFunctionBytes = std::max( largestFunctionBytes, released );
+    }
+}
+
+void StreamingOutput::link(const std::filesystem::path &outputFile, LLVMModuleRef module) {
+    emit( module, directory.getPath() / ( "module" OBJECT_FILE_EXTENSION ) );
+
+    if( stackUsage.report || stackUsage.limit!=0 ) {
+        std::ofstream report( stackUsageFile(outputFile) );
+        for( const auto &object : objects ) {
+            report<<std::ifstream( stackUsageFile(object) ).rdbuf();
+        }
+    }
+
+    // A response file keeps the command line short, however many functions there are
+    auto responseFileName = directory.getPath() / "objects";
+    {
+        std::ofstream responseFile( responseFileName );
+        for( const auto &object : objects ) {
+            responseFile<<object<<"\n";
+        }
+    }
+
+    std::string output = outputFile.string();
+    std::string responseArgument = "@" + responseFileName.string();
+    const char *linkerArguments[] = { TARGET_LD, "-r", "-o", output.c_str(), responseArgument.c_str(), nullptr };
+
+    pid_t linker;
+    int error = posix_spawnp( &linker, TARGET_LD, nullptr, nullptr, const_cast<char **>(linkerArguments), environ );
+    int status = 0;
+    if( error==0 && waitpid( linker, &status, 0 )<0 )
+        error = errno;
+
+    if( error!=0 || !WIFEXITED(status) || WEXITSTATUS(status)!=0 ) {
+        std::string msg = std::string("Failed to link streamed functions with " TARGET_LD);
+        if( error!=0 )
+            msg = msg + ": " + strerror(error);
+        emitMsg(MsgLevel::Error, output.c_str(), msg.c_str());
+        exit(1);
+    }
+
+    std::string msg = "Streamed " + std::to_string( objects.size()-1 ) + " functions, releasing " +
+            std::to_string( releasedBytes/1024 ) + "KiB of IR as they were emitted (largest function " +
+            std::to_string( largestFunctionBytes/1024 ) + "KiB)";
+    emitMsg(MsgLevel::Info, output.c_str(), msg.c_str());
+}
+
+void StreamingOutput::emit(LLVMModuleRef module, const std::filesystem::path &objectFile) {
+    emitObject( targetMachine, module, objectFile, stackUsage );
+    objects.push_back( objectFile );
+}
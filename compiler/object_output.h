@@ -10,15 +10,47 @@
 #define OBJECT_OUTPUT_H
 
 #include "code_gen.h"
+#include "temporary_directory.h"
 
 #include <llvm-c/TargetMachine.h>
 
 #include <filesystem>
+#include <vector>
 
+// Data layout of the generated modules
+extern const char TargetDataLayout[];
+
+// Emits the module to outputFile. With a stack limit, fails the compilation (after emitting) if a call chain may exceed
+// it
 class ObjectOutput {
 public:
     ObjectOutput(std::filesystem::path outputFile, const char *targetTriplet, ModuleGenImpl &module);
 
 };
 
+// Emits each function to an object file of its own as soon as it is complete, so that its IR can be released. The
+// objects are combined into the final output by the target's linker.
+class StreamingOutput : private NoCopy {
+    LLVMTargetMachineRef targetMachine;
+    const StackUsageOptions &stackUsage;
+    TemporaryDirectory directory;
+    std::vector<std::filesystem::path> objects;
+
+    size_t releasedBytes = 0, largestFunctionBytes = 0;
+
+public:
+    StreamingOutput(const char *targetTriplet, const CompilerOptions &options);
+    ~StreamingOutput();
+
+    // Emits a module holding a single function definition, then disposes of it
+    void emitFunction(LLVMModuleRef functionModule);
+
+    // Emits what remains of the module, and links it along with all functions into outputFile. The functions' stack
+    // usage reports, if any, are combined next to it
+    void link(const std::filesystem::path &outputFile, LLVMModuleRef module);
+
+private:
+    void emit(LLVMModuleRef module, const std::filesystem::path &objectFile);
+};
+
 #endif // OBJECT_OUTPUT_H
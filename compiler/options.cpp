@@ -0,0 +1,379 @@
+/* This file is part of the Practical programming langauge. https://github.com/Practical/practical-sa
+ *
+ * This file is file is copyright (C) 2018-2020 by its authors.
+ * You can see the file's authors in the AUTHORS file in the project's home repository.
+ *
+ * This is available under the Boost license. The license's text is available under the LICENSE file in the project's
+ * home directory.
+ */
+#include "config.h"
+
+#include "options.h"
+
+#include "support.h"
+
+#include <getopt.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <functional>
+#include <string>
+
+enum LongOptions {
+    OptLoopUnrollCount = 256,
+    OptLoopVectorizeWidth,
+    OptLoopNoAlias,
+    OptConditionalLowering,
+    OptMustTail,
+    OptNoAliasArguments,
+    OptStructLayout,
+    OptPackStruct,
+    OptStructAlign,
+    OptMemberAlign,
+    OptStructLayoutReport,
+    OptCoroutine,
+    OptCoroutineAllocator,
+    OptCoroutineDeallocator,
+    OptTargetClones,
+    OptInstrument,
+    OptStackUsage,
+    OptStackSizeSection,
+    OptStackLimit,
+    OptRemarksPassed,
+    OptRemarksMissed,
+    OptRemarksAnalysis,
+    OptSaveOptimizationRecord,
+    OptOptimizationRecordFile,
+    OptOptimizationRecordPasses,
+    OptHotnessThreshold,
+    OptConstEval,
+    OptConstEvalSteps,
+    OptConstEvalMemory,
+    OptNullBackend,
+    OptTrace,
+    OptPipeline,
+    OptStream,
+    OptFastISel,
+    OptGlobalISel,
+    OptDebugFast,
+    OptVerifyIR,
+};
+
+static const struct option longOptions[] = {
+    { "loop-unroll-count", required_argument, nullptr, OptLoopUnrollCount },
+    { "loop-vectorize-width", required_argument, nullptr, OptLoopVectorizeWidth },
+    { "loop-noalias", no_argument, nullptr, OptLoopNoAlias },
+    { "conditional-lowering", required_argument, nullptr, OptConditionalLowering },
+    { "musttail", no_argument, nullptr, OptMustTail },
+    { "noalias-args", no_argument, nullptr, OptNoAliasArguments },
+    { "struct-layout", required_argument, nullptr, OptStructLayout },
+    { "pack-struct", required_argument, nullptr, OptPackStruct },
+    { "struct-align", required_argument, nullptr, OptStructAlign },
+    { "member-align", required_argument, nullptr, OptMemberAlign },
+    { "struct-layout-report", no_argument, nullptr, OptStructLayoutReport },
+    { "coroutine", required_argument, nullptr, OptCoroutine },
+    { "coro-alloc", required_argument, nullptr, OptCoroutineAllocator },
+    { "coro-free", required_argument, nullptr, OptCoroutineDeallocator },
+    { "target-clones", required_argument, nullptr, OptTargetClones },
+    { "finstrument", required_argument, nullptr, OptInstrument },
+    { "fstack-usage", no_argument, nullptr, OptStackUsage },
+    { "fstack-size-section", no_argument, nullptr, OptStackSizeSection },
+    { "stack-limit", required_argument, nullptr, OptStackLimit },
+    { "Rpass", required_argument, nullptr, OptRemarksPassed },
+    { "Rpass-missed", required_argument, nullptr, OptRemarksMissed },
+    { "Rpass-analysis", required_argument, nullptr, OptRemarksAnalysis },
+    { "fsave-optimization-record", optional_argument, nullptr, OptSaveOptimizationRecord },
+    { "foptimization-record-file", required_argument, nullptr, OptOptimizationRecordFile },
+    { "foptimization-record-passes", required_argument, nullptr, OptOptimizationRecordPasses },
+    { "fdiagnostics-hotness-threshold", required_argument, nullptr, OptHotnessThreshold },
+    { "const-eval", no_argument, nullptr, OptConstEval },
+    { "const-eval-steps", required_argument, nullptr, OptConstEvalSteps },
+    { "const-eval-memory", required_argument, nullptr, OptConstEvalMemory },
+    { "null-backend", no_argument, nullptr, OptNullBackend },
+    { "trace", required_argument, nullptr, OptTrace },
+    { "pipeline", no_argument, nullptr, OptPipeline },
+    { "stream", no_argument, nullptr, OptStream },
+    { "fast-isel", no_argument, nullptr, OptFastISel },
+    { "global-isel", no_argument, nullptr, OptGlobalISel },
+    { "debug-fast", no_argument, nullptr, OptDebugFast },
+    { "verify-ir", no_argument, nullptr, OptVerifyIR },
+    { nullptr, 0, nullptr, 0 }
+};
+
+static unsigned parseUnsigned( const char *optionName, const char *value ) {
+    char *end = nullptr;
+    unsigned long ret = strtoul( value, &end, 10 );
+
+    if( *value=='\0' || *end!='\0' || ret>UINT_MAX ) {
+        std::string msg = std::string("Option ") + optionName + " expects a non-negative number, got \"" + value + "\"";
+        emitMsg(MsgLevel::Error, PACKAGE_NAME, msg.c_str());
+        exit(1);
+    }
+
+    return ret;
+}
+
+static ConditionalLowering parseConditionalLowering( const char *value ) {
+    if( strcmp(value, "auto")==0 )
+        return ConditionalLowering::Auto;
+    if( strcmp(value, "select")==0 )
+        return ConditionalLowering::Select;
+    if( strcmp(value, "branch")==0 )
+        return ConditionalLowering::Branch;
+
+    std::string msg = std::string("Option conditional-lowering expects auto, select or branch, got \"") + value + "\"";
+    emitMsg(MsgLevel::Error, PACKAGE_NAME, msg.c_str());
+    exit(1);
+}
+
+static bool parseStructLayout( const char *value ) {
+    if( strcmp(value, "declared")==0 )
+        return false;
+    if( strcmp(value, "reorder")==0 )
+        return true;
+
+    std::string msg = std::string("Option struct-layout expects declared or reorder, got \"") + value + "\"";
+    emitMsg(MsgLevel::Error, PACKAGE_NAME, msg.c_str());
+    exit(1);
+}
+
+// Without a value, the record is saved as YAML
+static const char *parseRecordFormat( const char *value ) {
+    if( value==nullptr || strcmp(value, "yaml")==0 )
+        return "yaml";
+    if( strcmp(value, "bitstream")==0 )
+        return "bitstream";
+
+    std::string msg = std::string("Option fsave-optimization-record expects yaml or bitstream, got \"") + value + "\"";
+    emitMsg(MsgLevel::Error, PACKAGE_NAME, msg.c_str());
+    exit(1);
+}
+
+// Parse NAME:VARIANTS, VARIANTS being a comma separated list of default and x86-64-v2 to x86-64-v4
+static void parseTargetClones( const char *value, std::unordered_map<std::string, std::vector<unsigned>> &clones ) {
+    const char *separator = strrchr( value, ':' );
+    if( separator==nullptr || separator==value ) {
+        std::string msg = std::string("Option target-clones expects NAME:VARIANTS, got \"") + value + "\"";
+        emitMsg(MsgLevel::Error, PACKAGE_NAME, msg.c_str());
+        exit(1);
+    }
+
+    std::vector<unsigned> &levels = clones[ std::string( value, separator ) ];
+    const char *variant = separator+1;
+    do {
+        size_t length = strcspn( variant, "," );
+        if( length==strlen("default") && strncmp( variant, "default", length )==0 ) {
+            // The baseline is always built
+        } else if( length==strlen("x86-64-vN") && strncmp( variant, "x86-64-v", length-1 )==0 &&
+                variant[length-1]>='2' && variant[length-1]<='4' )
+        {
+            levels.push_back( variant[length-1] - '0' );
+        } else {
+            std::string msg = std::string("Option target-clones expects variants default, x86-64-v2, x86-64-v3 or "
+                    "x86-64-v4, got \"") + value + "\"";
+            emitMsg(MsgLevel::Error, PACKAGE_NAME, msg.c_str());
+            exit(1);
+        }
+
+        variant += length;
+    } while( *variant++==',' );
+
+    std::sort( levels.begin(), levels.end(), std::greater<unsigned>() );
+    levels.erase( std::unique( levels.begin(), levels.end() ), levels.end() );
+}
+
+// Parse NAME:BYTES into alignments
+static void parseAlignment(
+        const char *optionName, const char *value, std::unordered_map<std::string, unsigned> &alignments )
+{
+    const char *separator = strrchr( value, ':' );
+    if( separator==nullptr || separator==value ) {
+        std::string msg = std::string("Option ") + optionName + " expects NAME:BYTES, got \"" + value + "\"";
+        emitMsg(MsgLevel::Error, PACKAGE_NAME, msg.c_str());
+        exit(1);
+    }
+
+    unsigned alignment = parseUnsigned( optionName, separator+1 );
+    if( alignment==0 || (alignment & (alignment-1))!=0 ) {
+        std::string msg = std::string("Option ") + optionName + " expects a power of two alignment, got \"" + value +
+                "\"";
+        emitMsg(MsgLevel::Error, PACKAGE_NAME, msg.c_str());
+        exit(1);
+    }
+
+    alignments[ std::string( value, separator ) ] = alignment;
+}
+
+int parseCommandLine( int argc, char *argv[], CompilerOptions &options ) {
+    // --debug-fast is a profile: explicit --fast-isel, --global-isel and --verify-ir take precedence, in any order
+    bool debugFast = false, verifyIR = false;
+
+    int option;
+    while( (option = getopt_long_only( argc, argv, "x:O:", longOptions, nullptr ))!=-1 ) {
+        switch( option ) {
+        case 'x':
+            if( strcmp(optarg, "practical")!=0 ) {
+                std::string msg = std::string("Unsupported source language \"") + optarg + "\"";
+                emitMsg(MsgLevel::Error, PACKAGE_NAME, msg.c_str());
+                exit(1);
+            }
+            options.practicalSource = true;
+            break;
+        case 'O':
+            // The module is never optimized as a whole. -O0 also turns off the per function passes of --pipeline and
+            // --stream
+            if( strcmp(optarg, "0")!=0 ) {
+                std::string msg = std::string("Unsupported optimization level -O") + optarg + ", only -O0 is supported";
+                emitMsg(MsgLevel::Error, PACKAGE_NAME, msg.c_str());
+                exit(1);
+            }
+            options.functionPasses = false;
+            break;
+        case OptLoopUnrollCount:
+            options.loopHints.unrollCount = parseUnsigned( "loop-unroll-count", optarg );
+            break;
+        case OptLoopVectorizeWidth:
+            options.loopHints.vectorizeWidth = parseUnsigned( "loop-vectorize-width", optarg );
+            break;
+        case OptLoopNoAlias:
+            options.loopHints.noAlias = true;
+            break;
+        case OptConditionalLowering:
+            options.conditionalLowering = parseConditionalLowering( optarg );
+            break;
+        case OptMustTail:
+            options.mustTail = true;
+            break;
+        case OptNoAliasArguments:
+            options.noAliasArguments = true;
+            break;
+        case OptStructLayout:
+            options.structLayout.reorder = parseStructLayout( optarg );
+            break;
+        case OptPackStruct:
+            options.structLayout.packed.insert( optarg );
+            break;
+        case OptStructAlign:
+            parseAlignment( "struct-align", optarg, options.structLayout.structAlignment );
+            break;
+        case OptMemberAlign:
+            parseAlignment( "member-align", optarg, options.structLayout.memberAlignment );
+            break;
+        case OptStructLayoutReport:
+            options.structLayout.report = true;
+            break;
+        case OptCoroutine:
+            options.coroutines.functions.insert( optarg );
+            break;
+        case OptCoroutineAllocator:
+            options.coroutines.allocator = optarg;
+            break;
+        case OptCoroutineDeallocator:
+            options.coroutines.deallocator = optarg;
+            break;
+        case OptTargetClones:
+            parseTargetClones( optarg, options.targetClones );
+            break;
+        case OptInstrument:
+            if( strcmp(optarg, "timing")!=0 ) {
+                std::string msg = std::string("Option finstrument expects timing, got \"") + optarg + "\"";
+                emitMsg(MsgLevel::Error, PACKAGE_NAME, msg.c_str());
+                exit(1);
+            }
+            options.timingProbes = true;
+            break;
+        case OptStackUsage:
+            options.stackUsage.report = true;
+            break;
+        case OptStackSizeSection:
+            options.stackUsage.section = true;
+            break;
+        case OptStackLimit:
+            options.stackUsage.limit = parseUnsigned( "stack-limit", optarg );
+            break;
+        case OptRemarksPassed:
+            options.remarks.passed = optarg;
+            break;
+        case OptRemarksMissed:
+            options.remarks.missed = optarg;
+            break;
+        case OptRemarksAnalysis:
+            options.remarks.analysis = optarg;
+            break;
+        case OptSaveOptimizationRecord:
+            options.remarks.recordFormat = parseRecordFormat( optarg );
+            break;
+        case OptOptimizationRecordFile:
+            options.remarks.recordFile = optarg;
+            if( options.remarks.recordFormat.empty() )
+                options.remarks.recordFormat = "yaml";
+            break;
+        case OptOptimizationRecordPasses:
+            options.remarks.recordPasses = optarg;
+            break;
+        case OptHotnessThreshold:
+            options.remarks.hotnessThreshold = parseUnsigned( "fdiagnostics-hotness-threshold", optarg );
+            break;
+        case OptConstEval:
+            options.constEval.enabled = true;
+            break;
+        case OptConstEvalSteps:
+            options.constEval.maxSteps = parseUnsigned( "const-eval-steps", optarg );
+            break;
+        case OptConstEvalMemory:
+            options.constEval.maxMemory = parseUnsigned( "const-eval-memory", optarg );
+            break;
+        case OptNullBackend:
+            options.nullBackend = true;
+            break;
+        case OptTrace:
+            options.traceFile = optarg;
+            break;
+        case OptPipeline:
+            options.pipeline = true;
+            break;
+        case OptStream:
+            options.streaming = true;
+            break;
+        case OptFastISel:
+            options.instructionSelector = InstructionSelector::Fast;
+            break;
+        case OptGlobalISel:
+            options.instructionSelector = InstructionSelector::Global;
+            break;
+        case OptDebugFast:
+            debugFast = true;
+            break;
+        case OptVerifyIR:
+            verifyIR = true;
+            break;
+        default:
+            // getopt already printed an error message
+            exit(1);
+        }
+    }
+
+    if( debugFast ) {
+        if( options.instructionSelector==InstructionSelector::Default )
+            options.instructionSelector = InstructionSelector::Fast;
+        options.verifyModule = verifyIR;
+        options.functionPasses = false;
+    }
+
+    if( options.mustTail && options.timingProbes ) {
+        // The exit probe runs after the call, so no call in tail position can be a tail call
+        emitMsg(MsgLevel::Error, PACKAGE_NAME, "--musttail can't be used with -finstrument=timing");
+        exit(1);
+    }
+
+    if( options.constEval.enabled && options.streaming ) {
+        emitMsg(MsgLevel::Warning, PACKAGE_NAME,
+                "--const-eval has no effect with --stream, as functions are emitted before calls to them can be "
+                "evaluated");
+        options.constEval.enabled = false;
+    }
+
+    return optind;
+}
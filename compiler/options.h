@@ -0,0 +1,160 @@
+/* This file is part of the Practical programming langauge. https://github.com/Practical/practical-sa
+ *
+ * To the extent header files enjoy copyright protection, this file is file is copyright (C) 2018-2020 by its authors
+ * You can see the file's authors in the AUTHORS file in the project's home repository.
+ *
+ * This is available under the Boost license. The license's text is available under the LICENSE file in the project's
+ * home directory.
+ */
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Hints attached to every loop the code generator produces
+struct LoopHints {
+    unsigned unrollCount = 0;           // 0 means leave it to the optimizer
+    unsigned vectorizeWidth = 0;        // 0 means leave it to the optimizer
+    bool noAlias = false;               // Memory accesses in different iterations never alias
+
+    bool any() const {
+        return unrollCount!=0 || vectorizeWidth!=0 || noAlias;
+    }
+};
+
+// How value producing conditionals (if c then a else b) are lowered
+enum class ConditionalLowering {
+    Auto,       // select when both clauses are cheap and side effect free, branch otherwise
+    Select,     // select whenever the clauses can be speculated, regardless of cost
+    Branch,     // always branch
+};
+
+// How struct members are laid out in memory
+struct StructLayoutOptions {
+    // Reorder members to minimize padding. Otherwise they are laid out in declaration order
+    bool reorder = false;
+    // Structs laid out without any padding, e.g. for wire formats. Never reordered
+    std::unordered_set<std::string> packed;
+    // Minimum alignment of structs, by struct name, and of members, by "struct.member"
+    std::unordered_map<std::string, unsigned> structAlignment, memberAlignment;
+    // Print each struct's size, padding and cache line boundaries as it is defined
+    bool report = false;
+};
+
+// Coroutines suspend with __builtin_coro_suspend(). Calling one runs it up to its first suspension and returns its
+// handle, through which it is resumed and destroyed
+struct CoroutineOptions {
+    // Coroutine functions, by mangled name
+    std::unordered_set<std::string> functions;
+    // Allocate and free the frames of coroutines whose allocation can't be elided, as allocator(size) and
+    // deallocator(frame)
+    std::string allocator = "malloc", deallocator = "free";
+};
+
+// Compile time evaluation of calls to pure functions with constant arguments
+struct ConstEvalOptions {
+    bool enabled = false;
+    // Basic blocks a single evaluation may execute before it is abandoned
+    unsigned maxSteps = 10000000;
+    // Bytes of stack frames a single evaluation may have live at once
+    unsigned maxMemory = 1<<20;
+};
+
+// Stack usage of the generated code, as measured by the code generator
+struct StackUsageOptions {
+    // Write each function's frame size, and whether it is static or dynamic, to a .su file next to the object
+    bool report = false;
+    // Record each function's frame size in the object's .stack_sizes section
+    bool section = false;
+    // Fail the compilation if a chain of direct calls may use more bytes of stack than this. 0 means no limit
+    unsigned limit = 0;
+};
+
+// Optimization remarks: what the optimization passes and the code generator did, or failed to do, and why. Remarks
+// are located at the start of the function they are about
+struct RemarkOptions {
+    // -Rpass, -Rpass-missed and -Rpass-analysis: regular expressions selecting, by pass name, the remarks of each kind
+    // to print. Empty selects none
+    std::string passed, missed, analysis;
+
+    // -fsave-optimization-record: save remarks in this format ("yaml" or "bitstream"). Empty saves none
+    std::string recordFormat;
+    // Defaults to the object's name, with an .opt.yaml or .opt.bitstream extension
+    std::string recordFile;
+    // Regular expression selecting, by pass name, the remarks to save. Empty saves all
+    std::string recordPasses;
+
+    // Only make remarks about code run at least this many times. Requires a profile
+    unsigned hotnessThreshold = 0;
+
+    bool enabled() const {
+        return !passed.empty() || !missed.empty() || !analysis.empty() || !recordFormat.empty();
+    }
+};
+
+// Instruction selector of the code generator. Code is generated at -O0, where LLVM defaults to FastISel
+enum class InstructionSelector {
+    Default,    // Whatever LLVM picks
+    Fast,       // FastISel, handing the instructions it can't select to SelectionDAG
+    Global,     // GlobalISel, handing the functions it can't select to SelectionDAG
+};
+
+struct CompilerOptions {
+    // -x practical: the input is Practical source whatever its name. Required for reading standard input ("-")
+    bool practicalSource = false;
+
+    LoopHints loopHints;
+    ConditionalLowering conditionalLowering = ConditionalLowering::Auto;
+    // Calls in tail position must not grow the stack. Fail the compilation if one can't be made musttail. Incompatible
+    // with timing probes
+    bool mustTail = false;
+    // Pointer arguments never alias each other or any other memory the function accesses (as with C's restrict)
+    bool noAliasArguments = false;
+
+    StructLayoutOptions structLayout;
+
+    CoroutineOptions coroutines;
+
+    // Functions, by mangled name, built once for the baseline target and once for each of the listed x86-64
+    // microarchitecture levels (2, 3 or 4 for x86-64-v2 to v4, highest first). Calls go through an ifunc whose resolver
+    // picks the highest level the CPU supports when the program is loaded
+    std::unordered_map<std::string, std::vector<unsigned>> targetClones;
+
+    // -finstrument=timing: probe every function's entry and returns with the cycle counter. Requires linking with
+    // libpractical-timing
+    bool timingProbes = false;
+
+    StackUsageOptions stackUsage;
+    RemarkOptions remarks;
+
+    // Anything other than Default also allocates registers with the fast (local, non-optimizing) allocator
+    InstructionSelector instructionSelector = InstructionSelector::Default;
+    // Check the IR is well formed before emitting it. --debug-fast skips this unless asked for with --verify-ir
+    bool verifyModule = true;
+
+    // Disabled, with a warning, when streaming, as functions are emitted before the calls to them can be evaluated
+    ConstEvalOptions constEval;
+
+    // Measure the front end on its own: replace code generation with a callback counter, or with a binary trace of
+    // the callbacks
+    bool nullBackend = false;
+    std::string traceFile;
+
+    // Generate code on a separate thread, overlapping it with semantic analysis. Each function is optimized as soon as
+    // it is complete.
+    bool pipeline = false;
+    // Optimize and emit each function as soon as it is complete, releasing its IR. Keeps memory use proportional to the
+    // largest function rather than to the whole module.
+    bool streaming = false;
+    // Run cheap optimization passes on each function as it is completed, with --pipeline or --stream. Off with -O0 and
+    // --debug-fast
+    bool functionPasses = true;
+};
+
+// Parse the command line into options. Returns the index in argv of the first non-option argument
+int parseCommandLine( int argc, char *argv[], CompilerOptions &options );
+
+#endif // OPTIONS_H
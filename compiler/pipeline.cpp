@@ -0,0 +1,76 @@
+/* This file is part of the Practical programming langauge. https://github.com/Practical/practical-sa
+ *
+ * This file is file is copyright (C) 2018-2020 by its authors.
+ * You can see the file's authors in the AUTHORS file in the project's home repository.
+ *
+ * This is available under the Boost license. The license's text is available under the LICENSE file in the project's
+ * home directory.
+ */
+#include "pipeline.h"
+
+#include "trace_reader.h"
+#include "trace_replayer.h"
+
+// Empty polls before the back end sleeps until the front end queues a chunk
+static constexpr unsigned SpinPolls = 1000;
+
+void PipelineTraceBuffer::flush() {
+    if( getUsed()==0 )
+        return;
+
+    TraceChunk *chunk = new TraceChunk;
+    chunk->size = getUsed();
+    chunk->data = release();
+    queue.push( chunk );
+}
+
+CodeGenPipeline::CodeGenPipeline( ModuleGenImpl &backEnd ) :
+    frontEnd( new TraceModuleGen( std::unique_ptr<TraceBuffer>( new PipelineTraceBuffer( queue ) ) ) ),
+    backEnd( backEnd ),
+    thread( &CodeGenPipeline::backEndMain, this )
+{
+}
+
+CodeGenPipeline::~CodeGenPipeline() {
+    finish();
+}
+
+ModuleGen *CodeGenPipeline::getFrontEnd() {
+    return frontEnd.get();
+}
+
+void CodeGenPipeline::finish() {
+    if( !thread.joinable() )
+        return;
+
+    TraceChunk *end = new TraceChunk;
+    end->last = true;
+    queue.push( end );
+
+    thread.join();
+}
+
+void CodeGenPipeline::backEndMain() {
+    TraceReplayer replayer( backEnd );
+    unsigned emptyPolls = 0;
+
+    while( true ) {
+        TraceChunk *chunk = queue.pop();
+        if( chunk==nullptr ) {
+            if( ++emptyPolls<SpinPolls )
+                std::this_thread::yield();
+            else
+                queue.wait();
+
+            continue;
+        }
+
+        emptyPolls = 0;
+        if( chunk->last )
+            break;
+
+        TraceReader reader( chunk->data.get(), chunk->size, "code generation pipeline" );
+        replayer.run( reader );
+        chunk->data.reset();
+    }
+}
@@ -0,0 +1,132 @@
+/* This file is part of the Practical programming langauge. https://github.com/Practical/practical-sa
+ *
+ * To the extent header files enjoy copyright protection, this file is file is copyright (C) 2018-2020 by its authors
+ * You can see the file's authors in the AUTHORS file in the project's home repository.
+ *
+ * This is available under the Boost license. The license's text is available under the LICENSE file in the project's
+ * home directory.
+ */
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "code_gen.h"
+#include "nocopy.h"
+#include "trace_writer.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Trace records passed from the front end to the back end. A chunk never splits a record, and a function's records
+// are never split between chunks.
+struct TraceChunk {
+    std::unique_ptr<uint8_t[]> data;
+    size_t size = 0;
+    bool last = false;
+    std::atomic<TraceChunk *> next{ nullptr };
+};
+
+// Queue of trace chunks, with a single producer and a single consumer. Lock free, except that pushing takes the lock
+// to wake the consumer when it sleeps in wait
+class TraceChunkQueue : private NoCopy {
+    // Owned by the consumer. The most recently popped chunk, or a placeholder
+    TraceChunk *head;
+    // Owned by the producer. The most recently pushed chunk
+    TraceChunk *tail;
+
+    std::mutex mutex;
+    std::condition_variable pushed;
+    std::atomic<bool> waiting{ false };
+
+public:
+    TraceChunkQueue() : head( new TraceChunk ), tail( head ) {}
+
+    ~TraceChunkQueue() {
+        while( head!=nullptr ) {
+            TraceChunk *next = head->next.load( std::memory_order_relaxed );
+            delete head;
+            head = next;
+        }
+    }
+
+    void push( TraceChunk *chunk ) {
+        tail->next.store( chunk, std::memory_order_release );
+        tail = chunk;
+
+        // Either the consumer sees the chunk before going to sleep, or we see it waiting
+        std::atomic_thread_fence( std::memory_order_seq_cst );
+        if( waiting.load( std::memory_order_relaxed ) ) {
+            std::lock_guard<std::mutex> lock( mutex );
+            pushed.notify_one();
+        }
+    }
+
+    // Returns nullptr if the queue is empty. The chunk remains owned by the queue, and is valid until the next pop
+    TraceChunk *pop() {
+        TraceChunk *next = head->next.load( std::memory_order_acquire );
+        if( next==nullptr )
+            return nullptr;
+
+        delete head;
+        head = next;
+
+        return next;
+    }
+
+    // Blocks the consumer until the queue is not empty
+    void wait() {
+        std::unique_lock<std::mutex> lock( mutex );
+        waiting.store( true, std::memory_order_relaxed );
+        std::atomic_thread_fence( std::memory_order_seq_cst );
+        pushed.wait( lock, [this]() { return head->next.load( std::memory_order_acquire )!=nullptr; } );
+        waiting.store( false, std::memory_order_relaxed );
+    }
+};
+
+// Queues the trace at the end of every function. Grows instead of flushing when full, so functions stay whole.
+class PipelineTraceBuffer : public TraceBuffer {
+    static constexpr size_t InitialSize = 64*1024;
+
+    TraceChunkQueue &queue;
+
+public:
+    explicit PipelineTraceBuffer( TraceChunkQueue &queue ) : TraceBuffer( InitialSize ), queue( queue ) {}
+
+    virtual void functionDone() override {
+        flush();
+    }
+
+    virtual void flush() override;
+
+protected:
+    virtual void overflow( size_t size ) override {
+        grow( size );
+    }
+};
+
+// Runs the code generator on a thread of its own. The front end's callbacks are recorded as trace records, and
+// replayed on the back end thread one function at a time, while the front end proceeds to the next one.
+class CodeGenPipeline : private NoCopy {
+    TraceChunkQueue queue;
+    std::unique_ptr<TraceModuleGen> frontEnd;
+    ModuleGenImpl &backEnd;
+    std::thread thread;
+
+public:
+    explicit CodeGenPipeline( ModuleGenImpl &backEnd );
+    ~CodeGenPipeline();
+
+    // The code generator to hand the semantic analyzer
+    ModuleGen *getFrontEnd();
+
+    // Waits for the back end to finish all complete functions passed so far. Records of a function the front end
+    // did not finish are dropped.
+    void finish();
+
+private:
+    void backEndMain();
+};
+
+#endif // PIPELINE_H
@@ -0,0 +1,88 @@
+/* This file is part of the Practical programming langauge. https://github.com/Practical/practical-sa
+ *
+ * This file is file is copyright (C) 2018-2020 by its authors.
+ * You can see the file's authors in the AUTHORS file in the project's home repository.
+ *
+ * This is available under the Boost license. The license's text is available under the LICENSE file in the project's
+ * home directory.
+ */
+#include "config.h"
+
+#include "remarks.h"
+
+#include "support.h"
+
+#include <llvm-c/Support.h>
+
+#include <stdlib.h>
+
+#include <string>
+
+static const char *remarkOption( RemarkKind kind ) {
+    switch( kind ) {
+    case RemarkKind::Passed:
+        return "-Rpass";
+    case RemarkKind::Missed:
+        return "-Rpass-missed";
+    case RemarkKind::Analysis:
+        return "-Rpass-analysis";
+    }
+
+    abort();
+}
+
+// Printed as "file:line:col: remark: message [-Rpass-missed=pass]", like the compiler's other diagnostics
+static void printRemark( const RemarkInfo &remark, void * ) {
+    std::string location = PACKAGE_NAME;
+    if( remark.file!=nullptr )
+        location = std::string(remark.file) + ":" + std::to_string(remark.line) + ":" + std::to_string(remark.column);
+
+    std::string msg = remark.message;
+    if( remark.hotness!=0 )
+        msg += " (hotness: " + std::to_string(remark.hotness) + ")";
+    msg = msg + " [" + remarkOption(remark.kind) + "=" + remark.passName + "]";
+
+    emitMsg(MsgLevel::Remark, location.c_str(), msg.c_str());
+}
+
+static const char *nullIfEmpty( const std::string &string ) {
+    return string.empty() ? nullptr : string.c_str();
+}
+
+OptimizationRemarks::OptimizationRemarks( const RemarkOptions &options, std::filesystem::path outputFile ) {
+    LLVMContextRef ctx = LLVMGetGlobalContext();
+
+    if( options.hotnessThreshold!=0 )
+        setRemarkHotnessThreshold( ctx, options.hotnessThreshold );
+
+    char *error = setRemarkHandler(
+            ctx, nullIfEmpty(options.passed), nullIfEmpty(options.missed), nullIfEmpty(options.analysis),
+            printRemark, nullptr );
+
+    if( error==nullptr && !options.recordFormat.empty() ) {
+        std::string recordFile = options.recordFile;
+        if( recordFile.empty() )
+            recordFile = outputFile.replace_extension( ".opt." + options.recordFormat ).string();
+
+        // Bitstream records also want a section in the object, listing them. Only Mach-O objects have one, and LLVM
+        // crashes emitting it to others. The record file is complete without it
+        if( options.recordFormat=="bitstream" ) {
+            const char *arguments[] = { "practicomp", "-remarks-section=false" };
+            LLVMParseCommandLineOptions( 2, arguments, nullptr );
+        }
+
+        record = startOptimizationRecord(
+                ctx, recordFile.c_str(), options.recordFormat.c_str(), nullIfEmpty(options.recordPasses), &error );
+    }
+
+    if( error!=nullptr ) {
+        emitMsg(MsgLevel::Error, PACKAGE_NAME, error);
+        LLVMDisposeMessage(error);
+        exit(1);
+    }
+}
+
+OptimizationRemarks::~OptimizationRemarks() {
+    if( record!=nullptr )
+        finishOptimizationRecord( record );
+}
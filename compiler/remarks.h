@@ -0,0 +1,29 @@
+/* This file is part of the Practical programming langauge. https://github.com/Practical/practical-sa
+ *
+ * To the extent header files enjoy copyright protection, this file is file is copyright (C) 2018-2020 by its authors
+ * You can see the file's authors in the AUTHORS file in the project's home repository.
+ *
+ * This is available under the Boost license. The license's text is available under the LICENSE file in the project's
+ * home directory.
+ */
+#ifndef REMARKS_H
+#define REMARKS_H
+
+#include "llvm_ext.h"
+#include "nocopy.h"
+#include "options.h"
+
+#include <filesystem>
+
+// Reports the optimization remarks the options select for as long as it exists. Remarks are made by the passes and the
+// code generator through the global context.
+class OptimizationRemarks : private NoCopy {
+    OptimizationRecordRef record = nullptr;
+
+public:
+    // Unless the options name one, the optimization record is saved next to outputFile
+    OptimizationRemarks( const RemarkOptions &options, std::filesystem::path outputFile );
+    ~OptimizationRemarks();
+};
+
+#endif // REMARKS_H
@@ -0,0 +1,76 @@
+/* This file is part of the Practical programming langauge. https://github.com/Practical/practical-sa
+ *
+ * This file is file is copyright (C) 2018-2020 by its authors.
+ * You can see the file's authors in the AUTHORS file in the project's home repository.
+ *
+ * This is available under the Boost license. The license's text is available under the LICENSE file in the project's
+ * home directory.
+ */
+
+
+// Replays a code generation trace recorded with --trace into the code generator, without running the semantic
+// analyzer. This gives repeatable measurements and profiles of the back end alone.
+#include "config.h"
+
+#include "code_gen.h"
+#include "mapped_file.h"
+#include "object_output.h"
+#include "options.h"
+#include "remarks.h"
+#include "support.h"
+#include "trace_reader.h"
+#include "trace_replayer.h"
+
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+
+static double millisecondsSince( std::chrono::steady_clock::time_point start ) {
+    return std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+}
+
+int main(int argc, char *argv[]) {
+    CompilerOptions options;
+    int firstArgument = parseCommandLine( argc, argv, options );
+
+    if( firstArgument>=argc ) {
+        emitMsg(MsgLevel::Error, "practireplay", "no trace file");
+        exit(1);
+    }
+
+    const char *traceFileName = argv[firstArgument];
+    MappedFile traceFile( traceFileName );
+    TraceReader reader( traceFile.getData(), traceFile.getSize(), traceFileName );
+    reader.readHeader();
+
+    ModuleGenImpl codeGen( options );
+    std::unique_ptr<StreamingOutput> streamingOutput;
+    if( options.streaming ) {
+        streamingOutput.reset( new StreamingOutput( TARGET_TRIPLET, options ) );
+        codeGen.setStreamingOutput( streamingOutput.get() );
+    }
+    TraceReplayer replayer( codeGen );
+
+    std::filesystem::path outputFileName = std::filesystem::path(traceFileName).filename();
+    outputFileName.replace_extension(".o");
+
+    std::unique_ptr<OptimizationRemarks> remarks;
+    if( options.remarks.enabled() )
+        remarks.reset( new OptimizationRemarks( options.remarks, outputFileName ) );
+
+    auto start = std::chrono::steady_clock::now();
+    replayer.run( reader );
+    if( replayer.inFunction() )
+        reader.corrupt( "Trace ends inside a function" );
+    double replayTime = millisecondsSince( start );
+
+    start = std::chrono::steady_clock::now();
+    ObjectOutput output(outputFileName, TARGET_TRIPLET, codeGen);
+    double outputTime = millisecondsSince( start );
+
+    std::cerr<<traceFileName<<": replayed "<<replayer.getNumRecords()<<" records in "<<replayTime<<"ms, object "
+            "output took "<<outputTime<<"ms\n";
+
+    return 0;
+}
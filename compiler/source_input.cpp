@@ -0,0 +1,129 @@
+/* This file is part of the Practical programming langauge. https://github.com/Practical/practical-sa
+ *
+ * This file is file is copyright (C) 2018-2020 by its authors.
+ * You can see the file's authors in the AUTHORS file in the project's home repository.
+ *
+ * This is available under the Boost license. The license's text is available under the LICENSE file in the project's
+ * home directory.
+ */
+#include "config.h"
+
+#include "source_input.h"
+
+#include "support.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static constexpr char StdinName[] = "stdin" PRACTICAL_SOURCE_FILE_EXTENSION;
+
+[[noreturn]] static void inputError( const char *operation ) {
+    std::string msg = std::string(operation) + ": " + strerror(errno);
+    emitMsg(MsgLevel::Error, PACKAGE_NAME, msg.c_str());
+    exit(1);
+}
+
+SourceInput::SourceInput( const char *fileName ) {
+    if( strcmp( fileName, "-" )!=0 ) {
+        path = fileName;
+
+        return;
+    }
+
+    struct stat stdinStat;
+    if( fstat( STDIN_FILENO, &stdinStat )<0 )
+        inputError( "Failed to stat standard input" );
+
+    if( S_ISREG( stdinStat.st_mode ) ) {
+        // Redirected from a file: let the semantic analyzer read it directly
+        expose( STDIN_FILENO, StdinName );
+    } else {
+        createMemoryFile( StdinName );
+        copyStandardInput();
+        expose( fd, StdinName );
+    }
+}
+
+SourceInput::SourceInput( const void *source, size_t size, const std::string &name ) {
+    createMemoryFile( name );
+    writeAll( source, size );
+    expose( fd, name );
+}
+
+SourceInput::~SourceInput() {
+    if( fd>=0 )
+        close( fd );
+}
+
+void SourceInput::createMemoryFile( const std::string &name ) {
+    fd = memfd_create( name.c_str(), MFD_CLOEXEC );
+    if( fd<0 )
+        inputError( "Failed to create memory file" );
+}
+
+void SourceInput::writeAll( const void *data, size_t size ) {
+    const char *source = static_cast<const char *>(data);
+
+    while( size>0 ) {
+        ssize_t result = write( fd, source, size );
+        if( result<0 ) {
+            if( errno==EINTR )
+                continue;
+
+            inputError( "Failed to write memory file" );
+        }
+
+        source += result;
+        size -= result;
+    }
+}
+
+void SourceInput::copyStandardInput() {
+    // Move pipe data without copying it through user space, if the kernel lets us
+    while( true ) {
+        ssize_t result = splice( STDIN_FILENO, nullptr, fd, nullptr, 1024*1024, SPLICE_F_MOVE );
+        if( result==0 )
+            return;
+
+        if( result<0 ) {
+            if( errno==EINTR )
+                continue;
+            if( errno==EINVAL )
+                break;
+
+            inputError( "Failed to read standard input" );
+        }
+    }
+
+    // Not a pipe (e.g. a terminal)
+    char buffer[64*1024];
+    while( true ) {
+        ssize_t result = read( STDIN_FILENO, buffer, sizeof(buffer) );
+        if( result==0 )
+            return;
+
+        if( result<0 ) {
+            if( errno==EINTR )
+                continue;
+
+            inputError( "Failed to read standard input" );
+        }
+
+        writeAll( buffer, result );
+    }
+}
+
+void SourceInput::expose( int exposedFd, const std::string &name ) {
+    if( !directory.create() )
+        inputError( "Failed to create temporary directory" );
+
+    path = directory.getPath() / name;
+    std::string target = "/proc/self/fd/" + std::to_string( exposedFd );
+    if( symlink( target.c_str(), path.c_str() )<0 )
+        inputError( "Failed to create source link" );
+}
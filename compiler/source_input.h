@@ -0,0 +1,44 @@
+/* This file is part of the Practical programming langauge. https://github.com/Practical/practical-sa
+ *
+ * To the extent header files enjoy copyright protection, this file is file is copyright (C) 2018-2020 by its authors
+ * You can see the file's authors in the AUTHORS file in the project's home repository.
+ *
+ * This is available under the Boost license. The license's text is available under the LICENSE file in the project's
+ * home directory.
+ */
+#ifndef SOURCE_INPUT_H
+#define SOURCE_INPUT_H
+
+#include "nocopy.h"
+#include "temporary_directory.h"
+
+#include <filesystem>
+#include <string>
+
+// Source code to hand to the semantic analyzer, which reads its input by path. Sources without a path of their own
+// (standard input, in memory buffers) are kept in an anonymous memory file, reachable through a symbolic link in a
+// temporary directory, so they never go through the disk.
+class SourceInput : private NoCopy {
+    std::filesystem::path path;
+    TemporaryDirectory directory;
+    int fd = -1;
+
+public:
+    // A source file, or standard input if fileName is "-"
+    explicit SourceInput( const char *fileName );
+    // Source held in memory. name is the file name the semantic analyzer sees
+    SourceInput( const void *source, size_t size, const std::string &name );
+    ~SourceInput();
+
+    const std::filesystem::path &getPath() const {
+        return path;
+    }
+
+private:
+    void createMemoryFile( const std::string &name );
+    void writeAll( const void *data, size_t size );
+    void copyStandardInput();
+    void expose( int exposedFd, const std::string &name );
+};
+
+#endif // SOURCE_INPUT_H
@@ -0,0 +1,200 @@
+/* This file is part of the Practical programming langauge. https://github.com/Practical/practical-sa
+ *
+ * This file is file is copyright (C) 2018-2020 by its authors.
+ * You can see the file's authors in the AUTHORS file in the project's home repository.
+ *
+ * This is available under the Boost license. The license's text is available under the LICENSE file in the project's
+ * home directory.
+ */
+#include "config.h"
+
+#include "stack_usage.h"
+
+#include "support.h"
+
+#include <fstream>
+#include <vector>
+
+namespace {
+
+struct Frame {
+    unsigned long long bytes = 0;
+    bool dynamic = false;
+};
+
+// Each line of the report reads "module:function<TAB>bytes<TAB>static" (or "dynamic")
+std::unordered_map< std::string, Frame > readStackUsage(
+        const std::filesystem::path &stackUsageFile, const CallGraph &callGraph )
+{
+    std::unordered_map< std::string, Frame > frames;
+
+    std::ifstream report( stackUsageFile );
+    std::string line;
+    while( std::getline( report, line ) ) {
+        size_t sizeStart = line.find('\t');
+        size_t kindStart = line.find( '\t', sizeStart+1 );
+        if( sizeStart==std::string::npos || kindStart==std::string::npos )
+            continue;
+
+        // The module's name may itself contain colons, so pick the longest suffix that names a function
+        std::string location = line.substr( 0, sizeStart );
+        for( size_t colon = location.find(':'); colon!=std::string::npos; colon = location.find( ':', colon+1 ) ) {
+            std::string name = location.substr( colon+1 );
+            if( callGraph.count(name)==0 )
+                continue;
+
+            Frame &frame = frames[name];
+            frame.bytes = std::stoull( line.substr( sizeStart+1, kindStart-sizeStart-1 ) );
+            frame.dynamic = line.compare( kindStart+1, std::string::npos, "dynamic" )==0;
+            break;
+        }
+    }
+
+    return frames;
+}
+
+class StackBoundChecker {
+    const CallGraph &callGraph;
+    const std::unordered_map< std::string, Frame > &frames;
+    const char *reportName;
+    unsigned returnAddressSize;
+
+    // The worst case stack use of a function and all it calls, and the callee through which it is reached
+    struct Bound {
+        unsigned long long bytes = 0;
+        const std::string *deepestCallee = nullptr;
+        bool bounded = true;
+        bool done = false;
+    };
+    std::unordered_map< std::string, Bound > bounds;
+    // The chain of calls currently being walked
+    std::vector<const std::string *> chain;
+
+    bool errors = false;
+
+public:
+    StackBoundChecker(
+            const CallGraph &callGraph, const std::unordered_map< std::string, Frame > &frames,
+            const char *reportName, unsigned returnAddressSize ) :
+        callGraph( callGraph ), frames( frames ), reportName( reportName ), returnAddressSize( returnAddressSize )
+    {}
+
+    bool hadErrors() const {
+        return errors;
+    }
+
+    const Bound &bound( const std::string &function ) {
+        Bound &result = bounds[function];
+        if( result.done )
+            return result;
+
+        // The frame sizes the code generator reports don't include the return address the call pushed
+        result.bytes = returnAddressSize;
+        auto frame = frames.find( function );
+        if( frame!=frames.end() ) {
+            result.bytes += frame->second.bytes;
+            if( frame->second.dynamic ) {
+                result.bounded = false;
+                error( "Function " + function + " has a dynamically sized stack frame, so calls through it have no "
+                        "static stack bound" );
+            }
+        }
+
+        auto callees = callGraph.find( function );
+        if( callees==callGraph.end() ) {
+            result.done = true;
+            return result;
+        }
+
+        chain.push_back( &callees->first );
+        unsigned long long deepest = 0;
+        for( const std::string &callee : callees->second ) {
+            if( checkRecursion( callee ) ) {
+                result.bounded = false;
+                continue;
+            }
+
+            const Bound &calleeBound = bound( callee );
+            result.bounded = result.bounded && calleeBound.bounded;
+            if( result.deepestCallee==nullptr || calleeBound.bytes>deepest ) {
+                deepest = calleeBound.bytes;
+                result.deepestCallee = &callee;
+            }
+        }
+        chain.pop_back();
+
+        // Rehashing bounds while walking the callees left result valid, as unordered_map never moves its elements
+        result.bytes += deepest;
+        result.done = true;
+        return result;
+    }
+
+    void checkRoot( const std::string &function, unsigned limit ) {
+        const Bound &rootBound = bound( function );
+        if( !rootBound.bounded || rootBound.bytes<=limit )
+            return;
+
+        std::string description = function;
+        for( const std::string *callee = rootBound.deepestCallee; callee!=nullptr;
+                callee = bounds[*callee].deepestCallee )
+        {
+            description += " -> " + *callee;
+        }
+
+        error( "Call chain " + description + " may use " + std::to_string( rootBound.bytes ) + " bytes of stack, "
+                "over the limit of " + std::to_string( limit ) );
+    }
+
+private:
+    // Whether calling callee from the end of the chain closes a cycle. Reports the cycle if it does
+    bool checkRecursion( const std::string &callee ) {
+        for( size_t i=0; i<chain.size(); ++i ) {
+            if( *chain[i]!=callee )
+                continue;
+
+            std::string description;
+            for( size_t j=i; j<chain.size(); ++j ) {
+                description += *chain[j] + " -> ";
+            }
+            error( "Call chain " + description + callee + " is recursive, so it has no static stack bound" );
+
+            return true;
+        }
+
+        return false;
+    }
+
+    void error( const std::string &msg ) {
+        emitMsg( MsgLevel::Error, reportName, msg.c_str() );
+        errors = true;
+    }
+};
+
+} // anonymous namespace
+
+bool checkStackBound(
+        const std::filesystem::path &stackUsageFile, const CallGraph &callGraph, unsigned limit,
+        unsigned returnAddressSize )
+{
+    std::unordered_map< std::string, Frame > frames = readStackUsage( stackUsageFile, callGraph );
+    std::string reportName = stackUsageFile.string();
+    StackBoundChecker checker( callGraph, frames, reportName.c_str(), returnAddressSize );
+
+    // Every chain is part of a chain that starts at a function not called from within the module
+    std::unordered_set<std::string> called;
+    for( const auto &function : callGraph ) {
+        called.insert( function.second.begin(), function.second.end() );
+    }
+
+    for( const auto &function : callGraph ) {
+        if( called.count( function.first )==0 )
+            checker.checkRoot( function.first, limit );
+    }
+
+    // Functions that are only reachable through recursion
+    for( const auto &function : callGraph ) {
+        checker.bound( function.first );
+    }
+
+    return !checker.hadErrors();
+}
@@ -0,0 +1,31 @@
+/* This file is part of the Practical programming langauge. https://github.com/Practical/practical-sa
+ *
+ * To the extent header files enjoy copyright protection, this file is file is copyright (C) 2018-2020 by its authors
+ * You can see the file's authors in the AUTHORS file in the project's home repository.
+ *
+ * This is available under the Boost license. The license's text is available under the LICENSE file in the project's
+ * home directory.
+ */
+#ifndef STACK_USAGE_H
+#define STACK_USAGE_H
+
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+// The functions defined in the module, by mangled name, with the functions each of them calls directly
+using CallGraph = std::unordered_map< std::string, std::unordered_set<std::string> >;
+
+// Check that no chain of direct calls may use more than limit bytes of stack. Frame sizes are read from the stack
+// usage report the code generator wrote while emitting the module, and each call adds returnAddressSize to them.
+// Functions not defined in the module (e.g. library functions) count as using no stack beyond their return address,
+// and neither does a leaf function's use of the red zone below the stack pointer, where the target has one.
+//
+// Reports each chain over the limit, each recursive chain and each function with a dynamically sized frame, as their
+// stack use has no static bound. Returns whether there were none.
+bool checkStackBound(
+        const std::filesystem::path &stackUsageFile, const CallGraph &callGraph, unsigned limit,
+        unsigned returnAddressSize );
+
+#endif // STACK_USAGE_H
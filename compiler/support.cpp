@@ -15,6 +15,9 @@
 void emitMsg(MsgLevel level, const char *fileName, const char *msg) {
     std::cerr << fileName << ": ";
     switch(level) {
+    case MsgLevel::Remark:
+        std::cerr << "remark: ";
+        break;
     case MsgLevel::Info:
         std::cerr << "info: ";
         break;
@@ -10,6 +10,7 @@
 #define SUPPORT_H
 
 enum class MsgLevel {
+    Remark,
     Info,
     Warning,
     Error,
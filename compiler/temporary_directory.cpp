@@ -0,0 +1,78 @@
+/* This file is part of the Practical programming langauge. https://github.com/Practical/practical-sa
+ *
+ * This file is file is copyright (C) 2018-2020 by its authors.
+ * You can see the file's authors in the AUTHORS file in the project's home repository.
+ *
+ * This is available under the Boost license. The license's text is available under the LICENSE file in the project's
+ * home directory.
+ */
+#include "config.h"
+
+#include "temporary_directory.h"
+
+#include <stdlib.h>
+
+#include <mutex>
+#include <string>
+#include <unordered_set>
+
+namespace {
+
+struct Registry {
+    std::mutex mutex;
+    // Directories not yet removed
+    std::unordered_set<std::string> directories;
+};
+
+// Never destroyed, as exit may remove the directories after static objects are gone
+Registry &registry() {
+    static Registry *instance = new Registry;
+    return *instance;
+}
+
+void remove( const std::string &directory ) {
+    std::error_code error;
+    std::filesystem::remove_all( directory, error );
+}
+
+// Errors call exit from deep within the compiler, skipping the destructors of the directories' owners
+void removeRemaining() {
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lock( reg.mutex );
+
+    for( const std::string &directory : reg.directories ) {
+        remove( directory );
+    }
+    reg.directories.clear();
+}
+
+} // anonymous namespace
+
+TemporaryDirectory::~TemporaryDirectory() {
+    if( path.empty() )
+        return;
+
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lock( reg.mutex );
+    reg.directories.erase( path.string() );
+    remove( path.string() );
+}
+
+bool TemporaryDirectory::create() {
+    std::string directoryTemplate = ( std::filesystem::temp_directory_path() / "practicomp-XXXXXX" ).string();
+    if( mkdtemp( directoryTemplate.data() )==nullptr )
+        return false;
+
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lock( reg.mutex );
+    static bool registered = false;
+    if( !registered ) {
+        atexit( removeRemaining );
+        registered = true;
+    }
+
+    reg.directories.insert( directoryTemplate );
+    path = directoryTemplate;
+
+    return true;
+}
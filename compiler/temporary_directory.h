@@ -0,0 +1,33 @@
+/* This file is part of the Practical programming langauge. https://github.com/Practical/practical-sa
+ *
+ * To the extent header files enjoy copyright protection, this file is file is copyright (C) 2018-2020 by its authors
+ * You can see the file's authors in the AUTHORS file in the project's home repository.
+ *
+ * This is available under the Boost license. The license's text is available under the LICENSE file in the project's
+ * home directory.
+ */
+#ifndef TEMPORARY_DIRECTORY_H
+#define TEMPORARY_DIRECTORY_H
+
+#include "nocopy.h"
+
+#include <filesystem>
+
+// A directory of the compiler's own under the system's temporary directory. It is removed, along with its contents,
+// when the object is destroyed, or when the compiler exits before that
+class TemporaryDirectory : private NoCopy {
+    std::filesystem::path path;
+
+public:
+    TemporaryDirectory() = default;
+    ~TemporaryDirectory();
+
+    // Returns false, with errno set, if the directory can't be created
+    bool create();
+
+    const std::filesystem::path &getPath() const {
+        return path;
+    }
+};
+
+#endif // TEMPORARY_DIRECTORY_H
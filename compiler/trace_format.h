@@ -0,0 +1,97 @@
+/* This file is part of the Practical programming langauge. https://github.com/Practical/practical-sa
+ *
+ * To the extent header files enjoy copyright protection, this file is file is copyright (C) 2018-2020 by its authors
+ * You can see the file's authors in the AUTHORS file in the project's home repository.
+ *
+ * This is available under the Boost license. The license's text is available under the LICENSE file in the project's
+ * home directory.
+ */
+#ifndef TRACE_FORMAT_H
+#define TRACE_FORMAT_H
+
+// Binary format of code generation callback traces.
+//
+// A trace starts with TraceMagic followed by TraceVersion (a varint). The rest is a sequence of records, each an
+// opcode byte followed by its operands. Unless noted otherwise, operands are unsigned LEB128 varints:
+// * IDs (ExpressionId, JumpPointId, ModuleId) are their numeric value.
+// * Types are handles. 0 is the null type, other handles are numbered consecutively from 1 and defined by a
+//   TraceOp::DefineType record that precedes their first use.
+// * Strings are a length followed by the raw bytes.
+// * Integer literals are the raw bytes of a LongEnoughInt, in host byte order.
+
+#include <stddef.h>
+#include <stdint.h>
+
+static constexpr char TraceMagic[8] = { 'P', 'R', 'T', 'R', 'A', 'C', 'E', '\0' };
+static constexpr uint32_t TraceVersion = 1;
+
+enum class TraceOp : uint8_t {
+    // Type table
+    DefineType = 1,             // handle, TraceTypeKind, flags, kind specific operands
+
+    // ModuleGen
+    ModuleEnter = 16,           // module id, name, file, line, col
+    ModuleLeave,                // module id
+    DeclareIdentifier,          // name, mangled name, type
+    DeclareStruct,              // type
+    DefineStruct,               // type, number of members, (name, type) per member
+
+    // FunctionGen
+    FunctionEnter = 32,         // name, return type, number of arguments, (name, type, lvalue id) per argument, file,
+                                // line, col
+    FunctionLeave,
+    ReturnValue,                // id
+    ReturnVoid,
+    ConditionalBranch,          // id, type, condition id, else point, continuation point
+    SetConditionClauseResult,   // id
+    SetJumpPoint,               // jump point, name
+    Jump,                       // jump point
+    SetLiteralInt,              // id, value, type
+    SetLiteralBool,             // id, value (one byte)
+    SetLiteralString,           // id, value
+    SetLiteralNull,             // id, type
+    AllocateStackVar,           // id, type, name
+    Assign,                     // lvalue id, rvalue id
+    DereferencePointer,         // id, type, address id
+    TruncateInteger,            // id, source id, source type, destination type
+    ChangeIntegerSign,          // id, source id, source type, destination type
+    ExpandIntegerSigned,        // id, source id, source type, destination type
+    ExpandIntegerUnsigned,      // id, source id, source type, destination type
+    CallFunctionDirect,         // id, name, number of arguments, argument ids, return type
+
+    // Binary operators: id, left id, right id, result type
+    BinaryOperatorPlusUnsigned = 64,
+    BinaryOperatorPlusSigned,
+    BinaryOperatorMinusUnsigned,
+    BinaryOperatorMinusSigned,
+    BinaryOperatorMultiplyUnsigned,
+    BinaryOperatorMultiplySigned,
+    BinaryOperatorDivideUnsigned,
+    OperatorEquals,
+    OperatorNotEquals,
+    OperatorLessThanUnsigned,
+    OperatorLessThanSigned,
+    OperatorLessThanOrEqualsUnsigned,
+    OperatorLessThanOrEqualsSigned,
+    OperatorGreaterThanUnsigned,
+    OperatorGreaterThanSigned,
+    OperatorGreaterThanOrEqualsUnsigned,
+    OperatorGreaterThanOrEqualsSigned,
+
+    OperatorLogicalNot = 96,    // id, argument id
+};
+
+// Bits of the flags operand of TraceOp::DefineType
+static constexpr uint64_t TraceTypeFlagReference = 1;
+static constexpr uint64_t TraceTypeFlagSigned = 2;        // Signed integer scalar
+
+enum class TraceTypeKind : uint8_t {
+    Void,                       // (scalar)
+    Integer,                    // bit width (scalar)
+    Function,                   // return type, number of arguments, argument types
+    Pointer,                    // pointed type
+    Array,                      // element type, number of elements
+    Struct,                     // name. Members are given by TraceOp::DefineStruct
+};
+
+#endif // TRACE_FORMAT_H
@@ -0,0 +1,32 @@
+/* This file is part of the Practical programming langauge. https://github.com/Practical/practical-sa
+ *
+ * This file is file is copyright (C) 2018-2020 by its authors.
+ * You can see the file's authors in the AUTHORS file in the project's home repository.
+ *
+ * This is available under the Boost license. The license's text is available under the LICENSE file in the project's
+ * home directory.
+ */
+#include "trace_reader.h"
+
+#include "support.h"
+
+#include <string.h>
+
+TraceReader::TraceReader( const uint8_t *data, size_t size, const std::string &fileName ) :
+    current(data), end(data+size), fileName(fileName)
+{
+}
+
+void TraceReader::readHeader() {
+    if( size_t(end-current)<sizeof(TraceMagic) || memcmp( current, TraceMagic, sizeof(TraceMagic) )!=0 )
+        corrupt( "Not a code generation trace" );
+    current += sizeof(TraceMagic);
+
+    if( varint()!=TraceVersion )
+        corrupt( "Unsupported trace version" );
+}
+
+void TraceReader::corrupt( const char *reason ) const {
+    emitMsg(MsgLevel::Error, fileName.c_str(), reason);
+    exit(1);
+}
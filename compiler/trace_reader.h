@@ -0,0 +1,83 @@
+/* This file is part of the Practical programming langauge. https://github.com/Practical/practical-sa
+ *
+ * To the extent header files enjoy copyright protection, this file is file is copyright (C) 2018-2020 by its authors
+ * You can see the file's authors in the AUTHORS file in the project's home repository.
+ *
+ * This is available under the Boost license. The license's text is available under the LICENSE file in the project's
+ * home directory.
+ */
+#ifndef TRACE_READER_H
+#define TRACE_READER_H
+
+#include "nocopy.h"
+#include "trace_format.h"
+
+#include <practical/practical.h>
+
+#include <string>
+
+using namespace PracticalSemanticAnalyzer;
+
+// Decodes the operands of a trace held in memory. Malformed input is reported as an error and exits.
+class TraceReader : private NoCopy {
+    const uint8_t *current, *end;
+    std::string fileName;
+
+public:
+    TraceReader( const uint8_t *data, size_t size, const std::string &fileName );
+
+    // Checks the header at the start of a trace file, leaving the reader at the first record
+    void readHeader();
+
+    bool done() const {
+        return current==end;
+    }
+
+    TraceOp op() {
+        need(1);
+        return static_cast<TraceOp>( *current++ );
+    }
+
+    uint64_t varint() {
+        uint64_t value = 0;
+        for( unsigned shift = 0; shift<64; shift += 7 ) {
+            need(1);
+            uint8_t byte = *current++;
+            value |= uint64_t(byte & 0x7f) << shift;
+
+            if( (byte & 0x80)==0 )
+                return value;
+        }
+
+        corrupt( "Varint too long" );
+    }
+
+    template<typename Id>
+    Id id() {
+        return Id( varint() );
+    }
+
+    // The returned string points into the trace's memory
+    String string() {
+        size_t size = varint();
+        return String( reinterpret_cast<const char *>( bytes(size) ), size );
+    }
+
+    const uint8_t *bytes( size_t size ) {
+        need(size);
+        const uint8_t *ret = current;
+        current += size;
+
+        return ret;
+    }
+
+    [[noreturn]] void corrupt( const char *reason ) const;
+
+private:
+    void need( size_t size ) const {
+        if( size_t(end-current)<size )
+            corrupt( "Trace file truncated" );
+    }
+};
+
+#endif // TRACE_READER_H
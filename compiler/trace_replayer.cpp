@@ -0,0 +1,351 @@
+/* This file is part of the Practical programming langauge. https://github.com/Practical/practical-sa
+ *
+ * This file is file is copyright (C) 2018-2020 by its authors.
+ * You can see the file's authors in the AUTHORS file in the project's home repository.
+ *
+ * This is available under the Boost license. The license's text is available under the LICENSE file in the project's
+ * home directory.
+ */
+#include "trace_replayer.h"
+
+#include <string.h>
+
+#include <utility>
+
+void TraceReplayer::run( TraceReader &reader ) {
+    in = &reader;
+    while( !in->done() ) {
+        TraceOp op = in->op();
+        ++numRecords;
+
+        switch( op ) {
+        case TraceOp::DefineType:
+            defineType();
+            break;
+        case TraceOp::ModuleEnter:
+            {
+                ModuleId id = in->id<ModuleId>();
+                String name = in->string();
+                String file = in->string();
+                size_t line = in->varint();
+                size_t col = in->varint();
+                module.moduleEnter( id, name, file, line, col );
+            }
+            break;
+        case TraceOp::ModuleLeave:
+            module.moduleLeave( in->id<ModuleId>() );
+            break;
+        case TraceOp::DeclareIdentifier:
+            {
+                in->string();
+                String mangledName = in->string();
+                const ReplayType &identifierType = type();
+                if( identifierType.expression==nullptr )
+                    in->corrupt( "Identifier declared without a type" );
+
+                if( LLVMGetTypeKind(identifierType.expression)==LLVMFunctionTypeKind ) {
+                    module.declareFunction(
+                            mangledName, identifierType.expression, identifierType.references,
+                            identifierType.signedValues );
+                } else {
+                    module.declareGlobal( mangledName, identifierType.expression );
+                }
+            }
+            break;
+        case TraceOp::DeclareStruct:
+            // The struct's LLVM type was created along with its type handle
+            type();
+            break;
+        case TraceOp::DefineStruct:
+            defineStruct();
+            break;
+        case TraceOp::FunctionEnter:
+            functionEnter();
+            break;
+        default:
+            if( function==nullptr )
+                in->corrupt( "Function record outside of a function" );
+
+            functionRecord( op );
+        }
+    }
+
+    in = nullptr;
+}
+
+void TraceReplayer::defineType() {
+    uint64_t handle = in->varint();
+    if( handle!=types.size() )
+        in->corrupt( "Type handles out of sequence" );
+
+    auto kind = static_cast<TraceTypeKind>( in->varint() );
+    uint64_t flags = in->varint();
+
+    ReplayType replayType;
+    switch( kind ) {
+    case TraceTypeKind::Void:
+        replayType.expression = LLVMVoidType();
+        break;
+    case TraceTypeKind::Integer:
+        replayType.expression = LLVMIntType( in->varint() );
+        break;
+    case TraceTypeKind::Function:
+        {
+            const ReplayType &returnType = type();
+            replayType.references.push_back( returnType.reference );
+            replayType.signedValues.push_back( returnType.isSigned );
+            std::vector<LLVMTypeRef> argumentTypes( in->varint() );
+            for( auto &argumentType : argumentTypes ) {
+                const ReplayType &replayArgument = type();
+                argumentType = replayArgument.parameter;
+                replayType.references.push_back( replayArgument.reference );
+                replayType.signedValues.push_back( replayArgument.isSigned );
+            }
+
+            replayType.expression =
+                    LLVMFunctionType( returnType.parameter, argumentTypes.data(), argumentTypes.size(), false );
+        }
+        break;
+    case TraceTypeKind::Pointer:
+        replayType.expression = LLVMPointerType( type().expression, 0 );
+        break;
+    case TraceTypeKind::Array:
+        {
+            LLVMTypeRef elementType = type().expression;
+            replayType.expression = LLVMArrayType( elementType, in->varint() );
+            replayType.parameter = LLVMPointerType( replayType.expression, 0 );
+        }
+        break;
+    case TraceTypeKind::Struct:
+        replayType.expression = LLVMStructCreateNamed( LLVMGetGlobalContext(), sliceToString( in->string() ).c_str() );
+        break;
+    default:
+        in->corrupt( "Unknown type kind" );
+    }
+
+    if( replayType.parameter==nullptr )
+        replayType.parameter = replayType.expression;
+
+    if( flags & TraceTypeFlagReference ) {
+        replayType.expression = LLVMPointerType( replayType.expression, 0 );
+        replayType.parameter = LLVMPointerType( replayType.parameter, 0 );
+        replayType.reference = true;
+    } else {
+        replayType.isSigned = ( flags & TraceTypeFlagSigned )!=0;
+    }
+
+    types.emplace_back( std::move(replayType) );
+}
+
+const TraceReplayer::ReplayType &TraceReplayer::type() {
+    uint64_t handle = in->varint();
+    if( handle>=types.size() )
+        in->corrupt( "Type used before its definition" );
+
+    return types[handle];
+}
+
+void TraceReplayer::defineStruct() {
+    LLVMTypeRef llvmStruct = type().expression;
+    std::vector<ModuleGenImpl::LoweredMember> members( in->varint() );
+    for( auto &member : members ) {
+        member.name = in->string();
+        member.type = type().expression;
+    }
+
+    module.defineStruct( llvmStruct, members );
+}
+
+void TraceReplayer::functionEnter() {
+    if( function!=nullptr )
+        in->corrupt( "Nested function" );
+
+    functionGen = module.handleFunction();
+    function = static_cast<FunctionGenImpl *>( functionGen.get() );
+
+    String name = in->string();
+    type();
+    std::vector<FunctionGenImpl::LoweredArgument> arguments( in->varint() );
+    for( auto &argument : arguments ) {
+        argument.name = in->string();
+        argument.type = type().parameter;
+        argument.lvalueId = in->id<ExpressionId>();
+    }
+    String file = in->string();
+    size_t line = in->varint();
+    size_t col = in->varint();
+
+    function->functionEnter( name, arguments, file, SourceLocation{ line, col } );
+}
+
+void TraceReplayer::callFunctionDirect() {
+    ExpressionId id = in->id<ExpressionId>();
+    String name = in->string();
+    std::vector<ExpressionId> arguments( in->varint() );
+    for( auto &argument : arguments ) {
+        argument = in->id<ExpressionId>();
+    }
+    type();
+
+    function->callFunctionDirect(
+            id, name, Slice<const ExpressionId>( arguments.data(), arguments.size() ), StaticType::CPtr() );
+}
+
+// Callbacks whose types the code generator doesn't look at are passed null types
+void TraceReplayer::functionRecord( TraceOp op ) {
+    switch( op ) {
+    case TraceOp::FunctionLeave:
+        function->functionLeave();
+        function = nullptr;
+        functionGen.reset();
+        break;
+    case TraceOp::ReturnValue:
+        function->returnValue( in->id<ExpressionId>() );
+        break;
+    case TraceOp::ReturnVoid:
+        function->returnValue();
+        break;
+    case TraceOp::ConditionalBranch:
+        {
+            ExpressionId id = in->id<ExpressionId>();
+            LLVMTypeRef llvmType = type().expression;
+            ExpressionId condition = in->id<ExpressionId>();
+            JumpPointId elsePoint = in->id<JumpPointId>();
+            JumpPointId continuationPoint = in->id<JumpPointId>();
+            function->conditionalBranch( id, llvmType, condition, elsePoint, continuationPoint );
+        }
+        break;
+    case TraceOp::SetConditionClauseResult:
+        function->setConditionClauseResult( in->id<ExpressionId>() );
+        break;
+    case TraceOp::SetJumpPoint:
+        {
+            JumpPointId id = in->id<JumpPointId>();
+            function->setJumpPoint( id, in->string() );
+        }
+        break;
+    case TraceOp::Jump:
+        function->jump( in->id<JumpPointId>() );
+        break;
+    case TraceOp::SetLiteralInt:
+        {
+            ExpressionId id = in->id<ExpressionId>();
+            LongEnoughInt value;
+            memcpy( &value, in->bytes( sizeof(value) ), sizeof(value) );
+            function->setLiteral( id, value, type().expression );
+        }
+        break;
+    case TraceOp::SetLiteralBool:
+        {
+            ExpressionId id = in->id<ExpressionId>();
+            function->setLiteral( id, in->varint()!=0 );
+        }
+        break;
+    case TraceOp::SetLiteralString:
+        {
+            ExpressionId id = in->id<ExpressionId>();
+            function->setLiteral( id, in->string() );
+        }
+        break;
+    case TraceOp::SetLiteralNull:
+        {
+            ExpressionId id = in->id<ExpressionId>();
+            function->setLiteralNull( id, type().expression );
+        }
+        break;
+    case TraceOp::AllocateStackVar:
+        {
+            ExpressionId id = in->id<ExpressionId>();
+            LLVMTypeRef llvmType = type().expression;
+            function->allocateStackVar( id, llvmType, in->string() );
+        }
+        break;
+    case TraceOp::Assign:
+        {
+            ExpressionId lvalue = in->id<ExpressionId>();
+            function->assign( lvalue, in->id<ExpressionId>() );
+        }
+        break;
+    case TraceOp::DereferencePointer:
+        {
+            ExpressionId id = in->id<ExpressionId>();
+            type();
+            function->dereferencePointer( id, StaticType::CPtr(), in->id<ExpressionId>() );
+        }
+        break;
+    case TraceOp::TruncateInteger:
+    case TraceOp::ChangeIntegerSign:
+    case TraceOp::ExpandIntegerSigned:
+    case TraceOp::ExpandIntegerUnsigned:
+        {
+            ExpressionId id = in->id<ExpressionId>();
+            ExpressionId source = in->id<ExpressionId>();
+            type();
+            LLVMTypeRef destType = type().expression;
+
+            switch( op ) {
+            case TraceOp::TruncateInteger:
+                function->truncateInteger( id, source, destType );
+                break;
+            case TraceOp::ChangeIntegerSign:
+                function->changeIntegerSign( id, source, StaticType::CPtr(), StaticType::CPtr() );
+                break;
+            case TraceOp::ExpandIntegerSigned:
+                function->expandIntegerSigned( id, source, destType );
+                break;
+            default:
+                function->expandIntegerUnsigned( id, source, destType );
+                break;
+            }
+        }
+        break;
+    case TraceOp::CallFunctionDirect:
+        callFunctionDirect();
+        break;
+    case TraceOp::OperatorLogicalNot:
+        {
+            ExpressionId id = in->id<ExpressionId>();
+            function->operatorLogicalNot( id, in->id<ExpressionId>() );
+        }
+        break;
+    default:
+        {
+            if( op<TraceOp::BinaryOperatorPlusUnsigned || op>TraceOp::OperatorGreaterThanOrEqualsSigned )
+                in->corrupt( "Unknown trace record" );
+
+            ExpressionId id = in->id<ExpressionId>();
+            ExpressionId left = in->id<ExpressionId>();
+            ExpressionId right = in->id<ExpressionId>();
+            type();
+
+            using BinaryOperator = void (FunctionGenImpl::*)(
+                    ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType );
+            static constexpr BinaryOperator binaryOperators[] = {
+                &FunctionGenImpl::binaryOperatorPlusUnsigned,
+                &FunctionGenImpl::binaryOperatorPlusSigned,
+                &FunctionGenImpl::binaryOperatorMinusUnsigned,
+                &FunctionGenImpl::binaryOperatorMinusSigned,
+                &FunctionGenImpl::binaryOperatorMultiplyUnsigned,
+                &FunctionGenImpl::binaryOperatorMultiplySigned,
+                &FunctionGenImpl::binaryOperatorDivideUnsigned,
+                &FunctionGenImpl::operatorEquals,
+                &FunctionGenImpl::operatorNotEquals,
+                &FunctionGenImpl::operatorLessThanUnsigned,
+                &FunctionGenImpl::operatorLessThanSigned,
+                &FunctionGenImpl::operatorLessThanOrEqualsUnsigned,
+                &FunctionGenImpl::operatorLessThanOrEqualsSigned,
+                &FunctionGenImpl::operatorGreaterThanUnsigned,
+                &FunctionGenImpl::operatorGreaterThanSigned,
+                &FunctionGenImpl::operatorGreaterThanOrEqualsUnsigned,
+                &FunctionGenImpl::operatorGreaterThanOrEqualsSigned,
+            };
+            static_assert(
+                    sizeof(binaryOperators)/sizeof(binaryOperators[0]) ==
+                    size_t(TraceOp::OperatorGreaterThanOrEqualsSigned) -
+                    size_t(TraceOp::BinaryOperatorPlusUnsigned) + 1 );
+
+            BinaryOperator handler = binaryOperators[ size_t(op) - size_t(TraceOp::BinaryOperatorPlusUnsigned) ];
+            (function->*handler)( id, left, right, StaticType::CPtr() );
+        }
+    }
+}
@@ -0,0 +1,66 @@
+/* This file is part of the Practical programming langauge. https://github.com/Practical/practical-sa
+ *
+ * To the extent header files enjoy copyright protection, this file is file is copyright (C) 2018-2020 by its authors
+ * You can see the file's authors in the AUTHORS file in the project's home repository.
+ *
+ * This is available under the Boost license. The license's text is available under the LICENSE file in the project's
+ * home directory.
+ */
+
+#ifndef TRACE_REPLAYER_H
+#define TRACE_REPLAYER_H
+
+#include "code_gen.h"
+#include "nocopy.h"
+#include "trace_reader.h"
+
+#include <memory>
+#include <vector>
+
+// Drives the code generator from trace records
+class TraceReplayer : private NoCopy {
+    // A type handle, lowered once when it is defined
+    struct ReplayType {
+        LLVMTypeRef expression = nullptr;
+        // Function arguments and return values pass arrays by pointer
+        LLVMTypeRef parameter = nullptr;
+        bool reference = false;
+        // Signed integer, passed by value
+        bool isSigned = false;
+        // Function types: whether the return value and each of the arguments is a reference, or a signed integer
+        std::vector<bool> references;
+        std::vector<bool> signedValues;
+    };
+
+    TraceReader *in = nullptr;
+    ModuleGenImpl &module;
+    std::vector< ReplayType > types;
+    std::shared_ptr<FunctionGen> functionGen;
+    FunctionGenImpl *function = nullptr;
+    size_t numRecords = 0;
+
+public:
+    explicit TraceReplayer( ModuleGenImpl &module ) : module(module), types(1) {}
+
+    // Replays all of the reader's records. A trace may be fed in several parts, as long as no record is split
+    // between them.
+    void run( TraceReader &reader );
+
+    bool inFunction() const {
+        return function!=nullptr;
+    }
+
+    size_t getNumRecords() const {
+        return numRecords;
+    }
+
+private:
+    void defineType();
+    const ReplayType &type();
+    void defineStruct();
+    void functionEnter();
+    void callFunctionDirect();
+    void functionRecord( TraceOp op );
+};
+
+#endif // TRACE_REPLAYER_H
@@ -0,0 +1,528 @@
+/* This file is part of the Practical programming langauge. https://github.com/Practical/practical-sa
+ *
+ * This file is file is copyright (C) 2018-2020 by its authors.
+ * You can see the file's authors in the AUTHORS file in the project's home repository.
+ *
+ * This is available under the Boost license. The license's text is available under the LICENSE file in the project's
+ * home directory.
+ */
+#include "trace_writer.h"
+
+#include "lookup_context.h"
+#include "support.h"
+
+#include <llvm-c/Core.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+TraceBuffer::TraceBuffer( size_t capacity ) : buffer( new uint8_t[capacity] ), capacity( capacity ) {
+}
+
+void TraceBuffer::bytes( const void *data, size_t size ) {
+    reserve(size);
+    memcpy( buffer.get()+used, data, size );
+    used += size;
+}
+
+std::unique_ptr<uint8_t[]> TraceBuffer::release() {
+    std::unique_ptr<uint8_t[]> ret( new uint8_t[capacity] );
+    ret.swap( buffer );
+    used = 0;
+
+    return ret;
+}
+
+void TraceBuffer::grow( size_t size ) {
+    while( capacity-used < size )
+        capacity *= 2;
+
+    std::unique_ptr<uint8_t[]> newBuffer( new uint8_t[capacity] );
+    memcpy( newBuffer.get(), buffer.get(), used );
+    buffer = std::move(newBuffer);
+}
+
+TraceFileBuffer::TraceFileBuffer( const std::string &fileName ) : TraceBuffer( BufferSize ), fileName( fileName ) {
+    fd = open( fileName.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0666 );
+    if( fd<0 ) {
+        std::string msg = std::string("Failed to open trace file: ") + strerror(errno);
+        emitMsg(MsgLevel::Error, fileName.c_str(), msg.c_str());
+        exit(1);
+    }
+
+    bytes( TraceMagic, sizeof(TraceMagic) );
+    varint( TraceVersion );
+}
+
+TraceFileBuffer::~TraceFileBuffer() {
+    flush();
+    close(fd);
+}
+
+void TraceFileBuffer::flush() {
+    const uint8_t *source = getData();
+    size_t size = getUsed();
+
+    while( size>0 ) {
+        ssize_t result = write( fd, source, size );
+        if( result<0 ) {
+            if( errno==EINTR )
+                continue;
+
+            std::string msg = std::string("Failed to write trace file: ") + strerror(errno);
+            emitMsg(MsgLevel::Error, fileName.c_str(), msg.c_str());
+            exit(1);
+        }
+
+        source += result;
+        size -= result;
+    }
+
+    clear();
+}
+
+void TraceFileBuffer::overflow( size_t size ) {
+    flush();
+    if( size>BufferSize )
+        grow( size );
+}
+
+TraceFunctionGen::TraceFunctionGen( TraceModuleGen *module ) : module(module), out( module->getBuffer() ) {
+}
+
+void TraceFunctionGen::functionEnter(
+        String name, StaticType::CPtr returnType, Slice<const ArgumentDeclaration> arguments,
+        String file, const SourceLocation &location)
+{
+    uint64_t returnTypeHandle = module->typeHandle(returnType);
+    std::vector<uint64_t> argumentTypeHandles;
+    argumentTypeHandles.reserve( arguments.size() );
+    for( const auto &argument : arguments ) {
+        argumentTypeHandles.push_back( module->typeHandle(argument.type) );
+    }
+
+    out.op( TraceOp::FunctionEnter );
+    out.string( name );
+    out.varint( returnTypeHandle );
+    out.varint( arguments.size() );
+    for( size_t i=0; i<arguments.size(); ++i ) {
+        out.string( arguments[i].name );
+        out.varint( argumentTypeHandles[i] );
+        out.id( arguments[i].lvalueId );
+    }
+    out.string( file );
+    out.varint( location.line );
+    out.varint( location.col );
+}
+
+void TraceFunctionGen::functionLeave() {
+    out.op( TraceOp::FunctionLeave );
+    out.functionDone();
+}
+
+void TraceFunctionGen::returnValue(ExpressionId id) {
+    out.op( TraceOp::ReturnValue );
+    out.id( id );
+}
+
+void TraceFunctionGen::returnValue() {
+    out.op( TraceOp::ReturnVoid );
+}
+
+void TraceFunctionGen::conditionalBranch(
+        ExpressionId id, StaticType::CPtr type, ExpressionId conditionExpression, JumpPointId elsePoint,
+        JumpPointId continuationPoint)
+{
+    uint64_t typeHandle = module->typeHandle(type);
+
+    out.op( TraceOp::ConditionalBranch );
+    out.id( id );
+    out.varint( typeHandle );
+    out.id( conditionExpression );
+    out.id( elsePoint );
+    out.id( continuationPoint );
+}
+
+void TraceFunctionGen::setConditionClauseResult( ExpressionId id ) {
+    out.op( TraceOp::SetConditionClauseResult );
+    out.id( id );
+}
+
+void TraceFunctionGen::setJumpPoint(JumpPointId id, String name) {
+    out.op( TraceOp::SetJumpPoint );
+    out.id( id );
+    out.string( name );
+}
+
+void TraceFunctionGen::jump(JumpPointId destination) {
+    out.op( TraceOp::Jump );
+    out.id( destination );
+}
+
+void TraceFunctionGen::setLiteral(ExpressionId id, LongEnoughInt value, StaticType::CPtr type) {
+    uint64_t typeHandle = module->typeHandle(type);
+
+    out.op( TraceOp::SetLiteralInt );
+    out.id( id );
+    out.bytes( &value, sizeof(value) );
+    out.varint( typeHandle );
+}
+
+void TraceFunctionGen::setLiteral(ExpressionId id, bool value) {
+    out.op( TraceOp::SetLiteralBool );
+    out.id( id );
+    out.varint( value );
+}
+
+void TraceFunctionGen::setLiteral(ExpressionId id, String value) {
+    out.op( TraceOp::SetLiteralString );
+    out.id( id );
+    out.string( value );
+}
+
+void TraceFunctionGen::setLiteralNull(ExpressionId id, StaticType::CPtr type) {
+    uint64_t typeHandle = module->typeHandle(type);
+
+    out.op( TraceOp::SetLiteralNull );
+    out.id( id );
+    out.varint( typeHandle );
+}
+
+void TraceFunctionGen::allocateStackVar(ExpressionId id, StaticType::CPtr type, String name) {
+    uint64_t typeHandle = module->typeHandle(type);
+
+    out.op( TraceOp::AllocateStackVar );
+    out.id( id );
+    out.varint( typeHandle );
+    out.string( name );
+}
+
+void TraceFunctionGen::assign( ExpressionId lvalue, ExpressionId rvalue ) {
+    out.op( TraceOp::Assign );
+    out.id( lvalue );
+    out.id( rvalue );
+}
+
+void TraceFunctionGen::dereferencePointer( ExpressionId id, StaticType::CPtr type, ExpressionId addr ) {
+    uint64_t typeHandle = module->typeHandle(type);
+
+    out.op( TraceOp::DereferencePointer );
+    out.id( id );
+    out.varint( typeHandle );
+    out.id( addr );
+}
+
+void TraceFunctionGen::truncateInteger(
+        ExpressionId id, ExpressionId source, StaticType::CPtr sourceType, StaticType::CPtr destType )
+{
+    integerConversion( TraceOp::TruncateInteger, id, source, sourceType, destType );
+}
+
+void TraceFunctionGen::changeIntegerSign(
+        ExpressionId id, ExpressionId source, StaticType::CPtr sourceType, StaticType::CPtr destType )
+{
+    integerConversion( TraceOp::ChangeIntegerSign, id, source, sourceType, destType );
+}
+
+void TraceFunctionGen::expandIntegerSigned(
+        ExpressionId id, ExpressionId source, StaticType::CPtr sourceType, StaticType::CPtr destType )
+{
+    integerConversion( TraceOp::ExpandIntegerSigned, id, source, sourceType, destType );
+}
+
+void TraceFunctionGen::expandIntegerUnsigned(
+        ExpressionId id, ExpressionId source, StaticType::CPtr sourceType, StaticType::CPtr destType )
+{
+    integerConversion( TraceOp::ExpandIntegerUnsigned, id, source, sourceType, destType );
+}
+
+void TraceFunctionGen::callFunctionDirect(
+        ExpressionId id, String name, Slice<const ExpressionId> arguments, StaticType::CPtr returnType )
+{
+    uint64_t typeHandle = module->typeHandle(returnType);
+
+    out.op( TraceOp::CallFunctionDirect );
+    out.id( id );
+    out.string( name );
+    out.varint( arguments.size() );
+    for( const auto &argument : arguments ) {
+        out.id( argument );
+    }
+    out.varint( typeHandle );
+}
+
+void TraceFunctionGen::binaryOperatorPlusUnsigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType )
+{
+    binaryOperator( TraceOp::BinaryOperatorPlusUnsigned, id, left, right, resultType );
+}
+
+void TraceFunctionGen::binaryOperatorPlusSigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType )
+{
+    binaryOperator( TraceOp::BinaryOperatorPlusSigned, id, left, right, resultType );
+}
+
+void TraceFunctionGen::binaryOperatorMinusUnsigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType )
+{
+    binaryOperator( TraceOp::BinaryOperatorMinusUnsigned, id, left, right, resultType );
+}
+
+void TraceFunctionGen::binaryOperatorMinusSigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType )
+{
+    binaryOperator( TraceOp::BinaryOperatorMinusSigned, id, left, right, resultType );
+}
+
+void TraceFunctionGen::binaryOperatorMultiplyUnsigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType )
+{
+    binaryOperator( TraceOp::BinaryOperatorMultiplyUnsigned, id, left, right, resultType );
+}
+
+void TraceFunctionGen::binaryOperatorMultiplySigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType )
+{
+    binaryOperator( TraceOp::BinaryOperatorMultiplySigned, id, left, right, resultType );
+}
+
+void TraceFunctionGen::binaryOperatorDivideUnsigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType )
+{
+    binaryOperator( TraceOp::BinaryOperatorDivideUnsigned, id, left, right, resultType );
+}
+
+void TraceFunctionGen::operatorEquals(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType )
+{
+    binaryOperator( TraceOp::OperatorEquals, id, left, right, resultType );
+}
+
+void TraceFunctionGen::operatorNotEquals(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType )
+{
+    binaryOperator( TraceOp::OperatorNotEquals, id, left, right, resultType );
+}
+
+void TraceFunctionGen::operatorLessThanUnsigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType )
+{
+    binaryOperator( TraceOp::OperatorLessThanUnsigned, id, left, right, resultType );
+}
+
+void TraceFunctionGen::operatorLessThanSigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType )
+{
+    binaryOperator( TraceOp::OperatorLessThanSigned, id, left, right, resultType );
+}
+
+void TraceFunctionGen::operatorLessThanOrEqualsUnsigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType )
+{
+    binaryOperator( TraceOp::OperatorLessThanOrEqualsUnsigned, id, left, right, resultType );
+}
+
+void TraceFunctionGen::operatorLessThanOrEqualsSigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType )
+{
+    binaryOperator( TraceOp::OperatorLessThanOrEqualsSigned, id, left, right, resultType );
+}
+
+void TraceFunctionGen::operatorGreaterThanUnsigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType )
+{
+    binaryOperator( TraceOp::OperatorGreaterThanUnsigned, id, left, right, resultType );
+}
+
+void TraceFunctionGen::operatorGreaterThanSigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType )
+{
+    binaryOperator( TraceOp::OperatorGreaterThanSigned, id, left, right, resultType );
+}
+
+void TraceFunctionGen::operatorGreaterThanOrEqualsUnsigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType )
+{
+    binaryOperator( TraceOp::OperatorGreaterThanOrEqualsUnsigned, id, left, right, resultType );
+}
+
+void TraceFunctionGen::operatorGreaterThanOrEqualsSigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType )
+{
+    binaryOperator( TraceOp::OperatorGreaterThanOrEqualsSigned, id, left, right, resultType );
+}
+
+void TraceFunctionGen::operatorLogicalNot( ExpressionId id, ExpressionId argument ) {
+    out.op( TraceOp::OperatorLogicalNot );
+    out.id( id );
+    out.id( argument );
+}
+
+void TraceFunctionGen::binaryOperator(
+        TraceOp op, ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType )
+{
+    uint64_t typeHandle = module->typeHandle(resultType);
+
+    out.op( op );
+    out.id( id );
+    out.id( left );
+    out.id( right );
+    out.varint( typeHandle );
+}
+
+void TraceFunctionGen::integerConversion(
+        TraceOp op, ExpressionId id, ExpressionId source, StaticType::CPtr sourceType, StaticType::CPtr destType )
+{
+    uint64_t sourceTypeHandle = module->typeHandle(sourceType);
+    uint64_t destTypeHandle = module->typeHandle(destType);
+
+    out.op( op );
+    out.id( id );
+    out.id( source );
+    out.varint( sourceTypeHandle );
+    out.varint( destTypeHandle );
+}
+
+TraceModuleGen::TraceModuleGen( const std::string &fileName ) : out( new TraceFileBuffer( fileName ) ) {
+}
+
+TraceModuleGen::TraceModuleGen( std::unique_ptr<TraceBuffer> out ) : out( std::move(out) ) {
+}
+
+uint64_t TraceModuleGen::typeHandle( StaticType::CPtr type ) {
+    if( !type )
+        return 0;
+
+    auto iter = typeHandles.find( type.get() );
+    if( iter!=typeHandles.end() )
+        return iter->second;
+
+    // Types referred to are defined first. Struct definitions don't refer to other types, which breaks any cycle.
+    std::vector<uint64_t> operands;
+    TraceTypeKind kind;
+    uint64_t flags = (type->getFlags() & StaticType::Flags::Reference) ? TraceTypeFlagReference : 0;
+
+    struct Visitor {
+        TraceModuleGen *module;
+        std::vector<uint64_t> &operands;
+        TraceTypeKind &kind;
+        uint64_t &flags;
+
+        void operator()( const StaticType::Scalar *scalar ) {
+            const ScalarType &scalarInfo = scalarType( scalar->getTypeId() );
+            if( LLVMGetTypeKind(scalarInfo.type)==LLVMVoidTypeKind ) {
+                kind = TraceTypeKind::Void;
+            } else {
+                kind = TraceTypeKind::Integer;
+                operands.push_back( LLVMGetIntTypeWidth(scalarInfo.type) );
+            }
+
+            if( scalarInfo.isSigned )
+                flags |= TraceTypeFlagSigned;
+        }
+        void operator()( const StaticType::Function *function ) {
+            kind = TraceTypeKind::Function;
+            operands.push_back( module->typeHandle( function->getReturnType() ) );
+            operands.push_back( function->getNumArguments() );
+            for( unsigned i=0; i<function->getNumArguments(); ++i ) {
+                operands.push_back( module->typeHandle( function->getArgumentType(i) ) );
+            }
+        }
+        void operator()( const StaticType::Pointer *pointer ) {
+            kind = TraceTypeKind::Pointer;
+            operands.push_back( module->typeHandle( pointer->getPointedType() ) );
+        }
+        void operator()( const StaticType::Array *array ) {
+            kind = TraceTypeKind::Array;
+            operands.push_back( module->typeHandle( array->getElementType() ) );
+            operands.push_back( array->getNumElements() );
+        }
+        void operator()( const StaticType::Struct *strct ) {
+            kind = TraceTypeKind::Struct;
+        }
+    };
+
+    std::visit( Visitor{ .module = this, .operands = operands, .kind = kind, .flags = flags }, type->getType() );
+
+    // Referred types might have been defined by now, so only now allocate this type's handle
+    uint64_t handle = types.size()+1;
+    types.push_back( type );
+    typeHandles.emplace( type.get(), handle );
+
+    out->op( TraceOp::DefineType );
+    out->varint( handle );
+    out->varint( static_cast<uint8_t>(kind) );
+    out->varint( flags );
+    for( uint64_t operand : operands ) {
+        out->varint( operand );
+    }
+    if( kind==TraceTypeKind::Struct ) {
+        out->string( std::get<const StaticType::Struct *>( type->getType() )->getName() );
+    }
+
+    return handle;
+}
+
+void TraceModuleGen::moduleEnter(
+        ModuleId id,
+        String name,
+        String file,
+        size_t line,
+        size_t col)
+{
+    out->op( TraceOp::ModuleEnter );
+    out->id( id );
+    out->string( name );
+    out->string( file );
+    out->varint( line );
+    out->varint( col );
+}
+
+void TraceModuleGen::moduleLeave(ModuleId id) {
+    out->op( TraceOp::ModuleLeave );
+    out->id( id );
+    out->flush();
+}
+
+void TraceModuleGen::declareIdentifier(String name, String mangledName, StaticType::CPtr type) {
+    uint64_t handle = typeHandle(type);
+
+    out->op( TraceOp::DeclareIdentifier );
+    out->string( name );
+    out->string( mangledName );
+    out->varint( handle );
+}
+
+void TraceModuleGen::declareStruct(StaticType::CPtr structType) {
+    uint64_t handle = typeHandle(structType);
+
+    out->op( TraceOp::DeclareStruct );
+    out->varint( handle );
+}
+
+void TraceModuleGen::defineStruct(StaticType::CPtr strctType) {
+    auto strct = std::get<const StaticType::Struct *>( strctType->getType() );
+    size_t numMembers = strct->getNumMembers();
+
+    uint64_t handle = typeHandle(strctType);
+    std::vector<uint64_t> memberTypeHandles;
+    memberTypeHandles.reserve(numMembers);
+    for( size_t i=0; i<numMembers; ++i ) {
+        memberTypeHandles.push_back( typeHandle( strct->getMember(i).type ) );
+    }
+
+    out->op( TraceOp::DefineStruct );
+    out->varint( handle );
+    out->varint( numMembers );
+    for( size_t i=0; i<numMembers; ++i ) {
+        out->string( strct->getMember(i).name );
+        out->varint( memberTypeHandles[i] );
+    }
+}
+
+std::shared_ptr<FunctionGen> TraceModuleGen::handleFunction() {
+    return std::shared_ptr<FunctionGen>( new TraceFunctionGen(this) );
+}
@@ -0,0 +1,232 @@
+/* This file is part of the Practical programming langauge. https://github.com/Practical/practical-sa
+ *
+ * To the extent header files enjoy copyright protection, this file is file is copyright (C) 2018-2020 by its authors
+ * You can see the file's authors in the AUTHORS file in the project's home repository.
+ *
+ * This is available under the Boost license. The license's text is available under the LICENSE file in the project's
+ * home directory.
+ */
+#ifndef TRACE_WRITER_H
+#define TRACE_WRITER_H
+
+#include "nocopy.h"
+#include "trace_format.h"
+
+#include <practical/practical.h>
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace PracticalSemanticAnalyzer;
+
+// Accumulates trace records in memory. Subclasses decide where they go once the buffer fills up or is flushed.
+class TraceBuffer : private NoCopy {
+    std::unique_ptr<uint8_t[]> buffer;
+    size_t capacity, used = 0;
+
+public:
+    explicit TraceBuffer( size_t capacity );
+    virtual ~TraceBuffer() = default;
+
+    void op( TraceOp op ) {
+        reserve(1);
+        buffer[used++] = static_cast<uint8_t>(op);
+    }
+
+    void varint( uint64_t value ) {
+        reserve(10);
+        while( value>=0x80 ) {
+            buffer[used++] = static_cast<uint8_t>(value) | 0x80;
+            value >>= 7;
+        }
+        buffer[used++] = static_cast<uint8_t>(value);
+    }
+
+    template<typename Id>
+    void id( Id id ) {
+        varint( id.get() );
+    }
+
+    void string( String str ) {
+        varint( str.size() );
+        bytes( str.get(), str.size() );
+    }
+
+    void bytes( const void *data, size_t size );
+
+    // Called after the last record of each function
+    virtual void functionDone() {}
+    virtual void flush() = 0;
+
+protected:
+    const uint8_t *getData() const {
+        return buffer.get();
+    }
+
+    size_t getUsed() const {
+        return used;
+    }
+
+    // Hands the buffer's content over to the caller, leaving the buffer empty
+    std::unique_ptr<uint8_t[]> release();
+    void clear() {
+        used = 0;
+    }
+    void grow( size_t size );
+
+    // Called when fewer than size bytes are left in the buffer
+    virtual void overflow( size_t size ) = 0;
+
+private:
+    void reserve( size_t size ) {
+        if( capacity-used < size )
+            overflow(size);
+    }
+};
+
+// Writes the trace to a file, starting with the trace header
+class TraceFileBuffer : public TraceBuffer {
+    static constexpr size_t BufferSize = 4*1024*1024;
+
+    std::string fileName;
+    int fd = -1;
+
+public:
+    explicit TraceFileBuffer( const std::string &fileName );
+    virtual ~TraceFileBuffer();
+
+    virtual void flush() override;
+
+protected:
+    virtual void overflow( size_t size ) override;
+};
+
+class TraceModuleGen;
+
+class TraceFunctionGen : public FunctionGen, private NoCopy {
+    TraceModuleGen *module;
+    TraceBuffer &out;
+
+public:
+    explicit TraceFunctionGen( TraceModuleGen *module );
+
+    virtual void functionEnter(
+            String name, StaticType::CPtr returnType, Slice<const ArgumentDeclaration> arguments,
+            String file, const SourceLocation &location) override;
+
+    virtual void functionLeave() override;
+
+    virtual void returnValue(ExpressionId id) override;
+    virtual void returnValue() override;
+
+    virtual void conditionalBranch(
+            ExpressionId id, StaticType::CPtr type, ExpressionId conditionExpression, JumpPointId elsePoint,
+            JumpPointId continuationPoint
+        ) override;
+    virtual void setConditionClauseResult( ExpressionId id ) override;
+    virtual void setJumpPoint(JumpPointId id, String name) override;
+    virtual void jump(JumpPointId destination) override;
+
+    virtual void setLiteral(ExpressionId id, LongEnoughInt value, StaticType::CPtr type) override;
+    virtual void setLiteral(ExpressionId id, bool value) override;
+    virtual void setLiteral(ExpressionId id, String value) override;
+    virtual void setLiteralNull(ExpressionId id, StaticType::CPtr type) override;
+
+    virtual void allocateStackVar(ExpressionId id, StaticType::CPtr type, String name) override;
+    virtual void assign( ExpressionId lvalue, ExpressionId rvalue ) override;
+    virtual void dereferencePointer( ExpressionId id, StaticType::CPtr type, ExpressionId addr ) override;
+
+    virtual void truncateInteger(
+            ExpressionId id, ExpressionId source, StaticType::CPtr sourceType, StaticType::CPtr destType ) override;
+    virtual void changeIntegerSign(
+            ExpressionId id, ExpressionId source, StaticType::CPtr sourceType, StaticType::CPtr destType ) override;
+    virtual void expandIntegerSigned(
+            ExpressionId id, ExpressionId source, StaticType::CPtr sourceType, StaticType::CPtr destType ) override;
+    virtual void expandIntegerUnsigned(
+            ExpressionId id, ExpressionId source, StaticType::CPtr sourceType, StaticType::CPtr destType ) override;
+    virtual void callFunctionDirect(
+            ExpressionId id, String name, Slice<const ExpressionId> arguments, StaticType::CPtr returnType ) override;
+
+    virtual void binaryOperatorPlusUnsigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType ) override;
+    virtual void binaryOperatorPlusSigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType ) override;
+    virtual void binaryOperatorMinusUnsigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType ) override;
+    virtual void binaryOperatorMinusSigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType ) override;
+    virtual void binaryOperatorMultiplyUnsigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType ) override;
+    virtual void binaryOperatorMultiplySigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType ) override;
+    virtual void binaryOperatorDivideUnsigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType ) override;
+
+    virtual void operatorEquals(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType ) override;
+    virtual void operatorNotEquals(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType ) override;
+    virtual void operatorLessThanUnsigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType ) override;
+    virtual void operatorLessThanSigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType ) override;
+    virtual void operatorLessThanOrEqualsUnsigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType ) override;
+    virtual void operatorLessThanOrEqualsSigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType ) override;
+    virtual void operatorGreaterThanUnsigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType ) override;
+    virtual void operatorGreaterThanSigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType ) override;
+    virtual void operatorGreaterThanOrEqualsUnsigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType ) override;
+    virtual void operatorGreaterThanOrEqualsSigned(
+            ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType ) override;
+
+
+    virtual void operatorLogicalNot( ExpressionId id, ExpressionId argument ) override;
+
+private:
+    void binaryOperator(
+            TraceOp op, ExpressionId id, ExpressionId left, ExpressionId right, StaticType::CPtr resultType );
+    void integerConversion(
+            TraceOp op, ExpressionId id, ExpressionId source, StaticType::CPtr sourceType, StaticType::CPtr destType );
+};
+
+// Records the code generation callbacks into a binary trace file instead of generating code
+class TraceModuleGen : public ModuleGen, private NoCopy {
+    std::unique_ptr<TraceBuffer> out;
+    std::unordered_map< const StaticType *, uint64_t > typeHandles;
+    // Keeps the traced types alive, so their addresses aren't reused for other types
+    std::vector< StaticType::CPtr > types;
+
+public:
+    explicit TraceModuleGen( const std::string &fileName );
+    explicit TraceModuleGen( std::unique_ptr<TraceBuffer> out );
+
+    TraceBuffer &getBuffer() {
+        return *out;
+    }
+
+    // Returns the type's handle, first writing its definition (and those of the types it refers to) if needed
+    uint64_t typeHandle( StaticType::CPtr type );
+
+    virtual void moduleEnter(
+            ModuleId id,
+            String name,
+            String file,
+            size_t line,
+            size_t col) override;
+
+    virtual void moduleLeave(ModuleId id) override;
+
+    virtual void declareIdentifier(String name, String mangledName, StaticType::CPtr type) override;
+    virtual void declareStruct(StaticType::CPtr structType) override;
+    virtual void defineStruct(StaticType::CPtr strct) override;
+
+    virtual std::shared_ptr<FunctionGen> handleFunction() override;
+};
+
+#endif // TRACE_WRITER_H
@@ -0,0 +1,38 @@
+/* This file is part of the Practical programming langauge. https://github.com/Practical/practical-sa
+ *
+ * To the extent header files enjoy copyright protection, this file is file is copyright (C) 2018-2020 by its authors
+ * You can see the file's authors in the AUTHORS file in the project's home repository.
+ *
+ * This is available under the Boost license. The license's text is available under the LICENSE file in the project's
+ * home directory.
+ */
+#ifndef PRACTICAL_TIMING_H
+#define PRACTICAL_TIMING_H
+
+// Interface between code compiled with -finstrument=timing and the timing runtime (libpractical-timing). The compiler
+// emits the probes below on entry to, and on every return from, each function. The runtime reports per function call
+// counts, total and self cycles and a histogram of call latencies when the program exits, and whenever it receives
+// SIGUSR2.
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// One per instrumented function, emitted by the compiler zero initialized except for the name
+struct PracticalTimingFunction {
+    // Assigned by the runtime on the function's first call
+    uint32_t id;
+    const char *name;
+};
+
+// timestamp is the cycle counter (rdtsc on x86), read by the probe itself
+void __practical_timing_enter( struct PracticalTimingFunction *function, uint64_t timestamp );
+void __practical_timing_exit( struct PracticalTimingFunction *function, uint64_t timestamp );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PRACTICAL_TIMING_H
@@ -0,0 +1,303 @@
+/* This file is part of the Practical programming langauge. https://github.com/Practical/practical-sa
+ *
+ * This file is file is copyright (C) 2018-2020 by its authors.
+ * You can see the file's authors in the AUTHORS file in the project's home repository.
+ *
+ * This is available under the Boost license. The license's text is available under the LICENSE file in the project's
+ * home directory.
+ */
+
+// Runtime for code compiled with -finstrument=timing. The probes only touch the calling thread's state, so they
+// never contend. The report merges all threads' counters, and is printed to stderr, or appended to the file named by
+// the PRACTICAL_TIMING_OUTPUT environment variable.
+#include "practical_timing.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr unsigned HistogramBuckets = 32;
+// Calls nested deeper than this are counted as part of the call they are nested in
+constexpr unsigned MaxDepth = 1024;
+constexpr unsigned ChunkSize = 256;
+constexpr unsigned MaxChunks = 1024;
+
+// A function's counters on one thread, on cache lines of their own. The owning thread is the only writer. Relaxed
+// atomics let the report read them while it runs, and compile to plain loads and stores
+struct alignas(64) Counters {
+    std::atomic<uint64_t> calls, totalCycles, selfCycles;
+    // Calls by the log2 of their total cycles
+    std::atomic<uint64_t> histogram[HistogramBuckets];
+};
+
+void add( std::atomic<uint64_t> &counter, uint64_t value ) {
+    counter.store( counter.load( std::memory_order_relaxed ) + value, std::memory_order_relaxed );
+}
+
+// Counters by function id, allocated a chunk at a time as functions are first called
+class CounterTable {
+    std::atomic<Counters *> chunks[MaxChunks] = {};
+
+public:
+    ~CounterTable() {
+        for( auto &chunk : chunks ) {
+            delete[] chunk.load( std::memory_order_relaxed );
+        }
+    }
+
+    const Counters *lookup( uint32_t id ) const {
+        const Counters *chunk = chunks[id / ChunkSize].load( std::memory_order_acquire );
+        return chunk!=nullptr ? chunk + id % ChunkSize : nullptr;
+    }
+
+    Counters &get( uint32_t id ) {
+        Counters *chunk = chunks[id / ChunkSize].load( std::memory_order_relaxed );
+        if( chunk==nullptr ) {
+            chunk = new Counters[ChunkSize]();
+            chunks[id / ChunkSize].store( chunk, std::memory_order_release );
+        }
+
+        return chunk[id % ChunkSize];
+    }
+};
+
+struct Frame {
+    uint32_t id;
+    uint64_t start, childCycles;
+};
+
+struct ThreadState {
+    CounterTable counters;
+    Frame stack[MaxDepth];
+    unsigned depth = 0;
+};
+
+struct Registry {
+    std::mutex mutex;
+    // Function names by id. Ids start at 1, as 0 marks functions not yet called
+    std::vector<const char *> names{ nullptr };
+    std::vector<ThreadState *> threads;
+    // Counters of threads that exited
+    CounterTable retired;
+    // SIGUSR2 writes to the pipe, waking the thread that prints the report
+    int wakeup[2] = { -1, -1 };
+};
+
+// Never destroyed, as instrumented code may run during exit
+Registry &registry() {
+    static Registry *instance = new Registry;
+    return *instance;
+}
+
+thread_local ThreadState *currentState = nullptr;
+
+uint32_t histogramBucket( uint64_t cycles ) {
+    if( cycles==0 )
+        return 0;
+
+    return std::min<uint32_t>( 63 - __builtin_clzll(cycles), HistogramBuckets-1 );
+}
+
+void accumulate( Counters &total, const Counters &counters ) {
+    add( total.calls, counters.calls.load( std::memory_order_relaxed ) );
+    add( total.totalCycles, counters.totalCycles.load( std::memory_order_relaxed ) );
+    add( total.selfCycles, counters.selfCycles.load( std::memory_order_relaxed ) );
+    for( unsigned i=0; i<HistogramBuckets; ++i ) {
+        add( total.histogram[i], counters.histogram[i].load( std::memory_order_relaxed ) );
+    }
+}
+
+void report() {
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lock( reg.mutex );
+
+    std::vector<Counters> totals( reg.names.size() );
+    for( uint32_t id=1; id<reg.names.size(); ++id ) {
+        if( const Counters *counters = reg.retired.lookup(id) )
+            accumulate( totals[id], *counters );
+
+        for( ThreadState *thread : reg.threads ) {
+            if( const Counters *counters = thread->counters.lookup(id) )
+                accumulate( totals[id], *counters );
+        }
+    }
+
+    std::vector<uint32_t> order;
+    for( uint32_t id=1; id<reg.names.size(); ++id ) {
+        if( totals[id].calls!=0 )
+            order.push_back( id );
+    }
+    std::sort( order.begin(), order.end(), [&]( uint32_t left, uint32_t right ) {
+            return totals[left].selfCycles > totals[right].selfCycles;
+        } );
+
+    FILE *output = stderr;
+    const char *outputName = getenv("PRACTICAL_TIMING_OUTPUT");
+    if( outputName!=nullptr && (output = fopen( outputName, "a" ))==nullptr )
+        output = stderr;
+
+    fprintf( output, "%12s %18s %18s %12s  %s\n", "calls", "total cycles", "self cycles", "cycles/call", "function" );
+    for( uint32_t id : order ) {
+        const Counters &counters = totals[id];
+        uint64_t calls = counters.calls;
+        fprintf( output, "%12llu %18llu %18llu %12llu  %s\n", (unsigned long long)calls,
+                (unsigned long long)counters.totalCycles, (unsigned long long)counters.selfCycles,
+                (unsigned long long)( counters.totalCycles / calls ), reg.names[id] );
+
+        fprintf( output, "%12s latency:", "" );
+        for( unsigned i=0; i<HistogramBuckets; ++i ) {
+            if( counters.histogram[i]!=0 )
+                fprintf( output, " <2^%u:%llu", i+1, (unsigned long long)counters.histogram[i] );
+        }
+        fprintf( output, "\n" );
+    }
+
+    if( output!=stderr )
+        fclose( output );
+    else
+        fflush( output );
+}
+
+void signalReport( int ) {
+    int savedErrno = errno;
+    char byte = 0;
+    (void)!write( registry().wakeup[1], &byte, 1 );
+    errno = savedErrno;
+}
+
+// Called with the registry locked, when the first function is called
+void start( Registry &reg ) {
+    atexit( report );
+
+    struct sigaction current;
+    if( sigaction( SIGUSR2, nullptr, &current )!=0 || current.sa_handler!=SIG_DFL )
+        return; // The program handles SIGUSR2 itself
+    if( pipe2( reg.wakeup, O_CLOEXEC )!=0 )
+        return;
+
+    std::thread( [fd = reg.wakeup[0]]() {
+            char byte;
+            ssize_t result;
+            while( (result = read( fd, &byte, 1 ))!=0 ) {
+                if( result>0 )
+                    report();
+                else if( errno!=EINTR )
+                    break;
+            }
+        } ).detach();
+
+    struct sigaction action = {};
+    action.sa_handler = signalReport;
+    action.sa_flags = SA_RESTART;
+    sigemptyset( &action.sa_mask );
+    sigaction( SIGUSR2, &action, nullptr );
+}
+
+uint32_t registerFunction( PracticalTimingFunction *function ) {
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lock( reg.mutex );
+
+    uint32_t id = __atomic_load_n( &function->id, __ATOMIC_RELAXED );
+    if( id!=0 )
+        return id;
+
+    if( reg.names.size()==1 )
+        start( reg );
+
+    if( reg.names.size()>=MaxChunks * ChunkSize ) {
+        fprintf( stderr, "practical-timing: too many instrumented functions\n" );
+        abort();
+    }
+
+    id = reg.names.size();
+    reg.names.push_back( function->name );
+    __atomic_store_n( &function->id, id, __ATOMIC_RELEASE );
+
+    return id;
+}
+
+uint32_t functionId( PracticalTimingFunction *function ) {
+    uint32_t id = __atomic_load_n( &function->id, __ATOMIC_ACQUIRE );
+    return id!=0 ? id : registerFunction( function );
+}
+
+// Merges the thread's counters into the retired ones when the thread exits
+struct ThreadRetirer {
+    ~ThreadRetirer() {
+        Registry &reg = registry();
+        std::lock_guard<std::mutex> lock( reg.mutex );
+
+        ThreadState *state = currentState;
+        for( uint32_t id=1; id<reg.names.size(); ++id ) {
+            if( const Counters *counters = state->counters.lookup(id) )
+                accumulate( reg.retired.get(id), *counters );
+        }
+
+        reg.threads.erase( std::find( reg.threads.begin(), reg.threads.end(), state ) );
+        delete state;
+        currentState = nullptr;
+    }
+};
+
+ThreadState &createThreadState() {
+    ThreadState *state = new ThreadState;
+    {
+        Registry &reg = registry();
+        std::lock_guard<std::mutex> lock( reg.mutex );
+        reg.threads.push_back( state );
+    }
+    currentState = state;
+
+    static thread_local ThreadRetirer retirer;
+
+    return *state;
+}
+
+inline ThreadState &threadState() {
+    ThreadState *state = currentState;
+    return state!=nullptr ? *state : createThreadState();
+}
+
+} // anonymous namespace
+
+void __practical_timing_enter( PracticalTimingFunction *function, uint64_t timestamp ) {
+    ThreadState &state = threadState();
+    if( state.depth<MaxDepth )
+        state.stack[state.depth] = Frame{ functionId(function), timestamp, 0 };
+
+    ++state.depth;
+}
+
+// The function is known from the frame it entered
+void __practical_timing_exit( PracticalTimingFunction *, uint64_t timestamp ) {
+    ThreadState &state = threadState();
+    if( state.depth==0 )
+        return; // Entered on a thread state that already retired
+
+    --state.depth;
+    if( state.depth>=MaxDepth )
+        return;
+
+    const Frame &frame = state.stack[state.depth];
+    uint64_t cycles = timestamp - frame.start;
+
+    Counters &counters = state.counters.get( frame.id );
+    add( counters.calls, 1 );
+    add( counters.totalCycles, cycles );
+    add( counters.selfCycles, cycles - std::min( frame.childCycles, cycles ) );
+    add( counters.histogram[ histogramBucket(cycles) ], 1 );
+
+    if( state.depth>0 )
+        state.stack[state.depth-1].childCycles += cycles;
+}